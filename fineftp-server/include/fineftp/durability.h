@@ -0,0 +1,17 @@
+#pragma once
+
+namespace fineftp
+{
+  /**
+   * @brief When uploaded data is made durable, i.e. flushed to the disk
+   *
+   * The server only replies with 226 (transfer complete) once the data of an
+   * upload is as durable as configured. See FtpServer::setDurabilityPolicy().
+   */
+  enum class DurabilityPolicy : int
+  {
+    None,         /**< Leave flushing the data to the operating system. A 226 reply does not mean that the data survives a crash. (default) */
+    SyncOnClose,  /**< Sync each uploaded file on its own before replying with 226 */
+    GroupCommit,  /**< Sync the files of concurrent uploads together in a background thread before replying with 226 */
+  };
+}
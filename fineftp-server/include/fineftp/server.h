@@ -7,7 +7,9 @@
 #include <iostream>
 
 // IWYU pragma: begin_exports
+#include <fineftp/durability.h>
 #include <fineftp/permissions.h>
+#include <fineftp/user_settings.h>
 
 #include <fineftp/fineftp_version.h>
 #include <fineftp/fineftp_export.h>
@@ -134,6 +136,23 @@ namespace fineftp
      */
     FINEFTP_EXPORT bool addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions);
 
+    /**
+     * @brief Adds a new user with additional settings
+     * 
+     * Works like addUser(const std::string&, const std::string&, const std::string&, Permission),
+     * but additionally applies the given settings to the user, e.g. a
+     * bandwidth limit that all transfers of the user share.
+     * 
+     * @param username:         The username for login
+     * @param password:         The user's password
+     * @param local_root_path:  A path to any resource on the local filesystem that will be accessed by the user
+     * @param permissions:      A bit-mask of what the user will be able to do.
+     * @param settings:         Additional settings of the user
+     *
+     * @return True if adding the user was successful (i.e. it didn't exit already).
+     */
+    FINEFTP_EXPORT bool addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions, const UserSettings& settings);
+
     /**
      * @brief Adds the "anonymous" / "ftp" user that FTP clients use to access FTP servers without password
      * 
@@ -144,6 +163,213 @@ namespace fineftp
      */
     FINEFTP_EXPORT bool addUserAnonymous(const std::string& local_root_path, Permission permissions);
 
+    /**
+     * @brief Adds the "anonymous" / "ftp" user with additional settings
+     * 
+     * @param local_root_path:  A path to any resource on the local filesystem that will be accessed by the user
+     * @param permissions:      A bit-mask of what the user will be able to do.
+     * @param settings:         Additional settings of the user
+     * 
+     * @return True if adding the anonymous user was successful (i.e. it didn't exit already).
+     */
+    FINEFTP_EXPORT bool addUserAnonymous(const std::string& local_root_path, Permission permissions, const UserSettings& settings);
+
+    /**
+     * @brief Sets the size of the file segments that are mapped into memory when sending a file
+     * 
+     * Files are not mapped into memory as a whole. Instead, a window of the
+     * given size is mapped, sent and released again, while the next window is
+     * already being read ahead by the operating system. Large windows reduce
+     * the number of map operations, small windows reduce the address space
+     * used by each download. Defaults to 16 MiB.
+     * 
+     * On Linux, files are usually sent with sendfile() and the window size is
+     * only used when sendfile() is not available for a file.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param window_size:  The window size in bytes. Must not be 0.
+     */
+    FINEFTP_EXPORT void setFileWindowSize(size_t window_size);
+
+    /**
+     * @brief Limits the bandwidth of all transfers of the server combined
+     * 
+     * The limit applies to uploads, downloads and directory listings. The
+     * data is transferred in chunks and the transfers pause between the
+     * chunks as required, so no thread is blocked by the limit. Limits of
+     * individual users (see UserSettings) apply in addition.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param bytes_per_second:  The maximum bandwidth in bytes per second. 0 means unlimited (default).
+     */
+    FINEFTP_EXPORT void setMaxBytesPerSecond(size_t bytes_per_second);
+
+    /**
+     * @brief Sets the number of bytes a transfer may move at once
+     * 
+     * Uploads, downloads and directory listings take turns on the worker
+     * threads. Each turn, a transfer may send or receive one quantum (times
+     * the transfer weight of the user, see UserSettings), so a few large
+     * transfers cannot starve the others. A transfer only takes a turn when
+     * its socket is ready, so slow clients don't hold up anyone. What a
+     * transfer could not move in its turn is added to its next turn (deficit
+     * round robin), up to one more quantum.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param quantum_size:  The quantum size in bytes. Must not be 0. Default: 256 KiB.
+     */
+    FINEFTP_EXPORT void setTransferQuantumSize(size_t quantum_size);
+
+    /**
+     * @brief Keeps recently downloaded files open
+     * 
+     * Files are opened when they are downloaded and shared by all concurrent
+     * downloads. With the cache, the most recently used files also stay open
+     * after their last download has finished, so repeated downloads of the
+     * same files don't have to open them again. The least recently used files
+     * are closed first when one of the limits is exceeded. Files that are
+     * modified or removed through the server are dropped from the cache.
+     * 
+     * Must be called before the server is started.
+     * 
+     * The size limit is the sum of the sizes of the cached files, not the
+     * memory they use: a cached file only keeps its handle open. It bounds
+     * the disk space that removed files keep occupying while they are cached.
+     * 
+     * @param max_total_file_size:  The maximum sum of the sizes of the cached files. 0 disables the cache (default).
+     * @param max_entries:          The maximum number of cached files. 0 disables the cache (default).
+     */
+    FINEFTP_EXPORT void setFileCacheLimits(size_t max_total_file_size, size_t max_entries);
+
+    /**
+     * @brief Keeps large files from flooding the page cache
+     * 
+     * Streaming a huge file that is read only once (e.g. a backup) through
+     * the page cache evicts the small files that are downloaded over and
+     * over again. Files of at least the given size are therefore dropped from
+     * the page cache right after they have been sent. Users can also be
+     * configured to stream all of their downloads this way (see
+     * UserSettings).
+     * 
+     * Only has an effect on Linux.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param file_size:  The minimum file size in bytes. 0 disables the threshold (default).
+     */
+    FINEFTP_EXPORT void setColdStreamingThreshold(size_t file_size);
+
+    /**
+     * @brief Sets when the data of uploads is flushed to the disk
+     * 
+     * By default, the data of an upload is handed to the operating system
+     * and a 226 reply does not mean that it survives a crash. With
+     * DurabilityPolicy::SyncOnClose, each file (and the directory of a new
+     * file) is synced on its own before the transfer is reported as
+     * complete. That is safe, but slow for many small files.
+     * DurabilityPolicy::GroupCommit syncs the files of all uploads that
+     * finish at about the same time in a single round on a background
+     * thread, so they wait for the disk together. On Linux 5.8 and newer, a
+     * round flushes each file system once for the data and once for the
+     * renames (with syncfs(), which also flushes unrelated data of the file
+     * system). Elsewhere the files are synced one by one and each directory
+     * is synced once per round.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param policy:  The durability policy. Defaults to DurabilityPolicy::None.
+     */
+    FINEFTP_EXPORT void setDurabilityPolicy(DurabilityPolicy policy);
+
+    /**
+     * @brief Makes uploaded files appear only once they are complete
+     * 
+     * By default, STOR truncates the target file and writes the data into
+     * it, so other readers may see partially uploaded files. With atomic
+     * uploads, STOR and STOU write the data to a hidden temporary file in the
+     * target directory. Once the upload has completed, the temporary file
+     * replaces the target file in a single rename. Failed uploads leave
+     * neither a partial file nor a temporary file behind.
+     * 
+     * Appending (APPE) and resuming uploads (REST + STOR) modify the existing
+     * file and are therefore never atomic.
+     * 
+     * With a DurabilityPolicy other than None, the directory is synced after
+     * the rename, so the new file also replaces the old one on the disk
+     * before 226 is sent.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param enable:  Whether uploads are atomic. Defaults to false.
+     */
+    FINEFTP_EXPORT void setAtomicUploads(bool enable);
+
+    /**
+     * @brief Sets the range of the read size of uploads
+     * 
+     * Uploads read data from the network in chunks. Each upload starts with
+     * the minimum size (or the size announced with ALLO, if larger) and then
+     * adapts the size to the data that is waiting in the socket: Reads that
+     * fill the buffer double it, reads that return little of it halve it
+     * again, unless the receive rate still needs it. Slow uploads keep small
+     * buffers, fast uploads use large ones to save system calls. A read never
+     * exceeds the transfer quantum (see setTransferQuantumSize()). The
+     * current size and rate of a session are reported by the STAT command.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param min_size:  The minimum read size in bytes. Defaults to 64 KiB. Must not be 0.
+     * @param max_size:  The maximum read size in bytes. Defaults to 4 MiB. Must not be smaller than min_size.
+     */
+    FINEFTP_EXPORT void setReceiveBufferSizeLimits(size_t min_size, size_t max_size);
+
+    /**
+     * @brief Sets the number of threads that gather the metadata of directory listings
+     * 
+     * LIST and MLSD need the status (size, time, ...) of every entry of the
+     * listed directory. The entries are read in batches and the status of the
+     * entries of a batch is queried by up to this many threads in parallel.
+     * On storage where the latency is the limit (e.g. NVMe drives and network
+     * filesystems), this speeds up the listing of big directories a lot. The
+     * threads are shared by all listings of the server.
+     * 
+     * Listings are sorted by name. All names of a directory are read and
+     * sorted first. The entries are then stat'ed, formatted and sent in
+     * batches of 512 entries, so the formatted listing of a big directory
+     * never has to be held in memory as a whole.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param thread_count:  The number of threads. Defaults to 4. Must not be 0.
+     */
+    FINEFTP_EXPORT void setDirectoryListingThreadCount(size_t thread_count);
+
+    /**
+     * @brief Keeps the listings of recently listed directories
+     * 
+     * Clients that poll directories make the server read the directory, stat
+     * all entries and format the listing again and again. With the cache, the
+     * formatted listings (LIST, NLST and MLSD) are kept in memory and repeated
+     * listings of an unchanged directory are sent straight from there. The
+     * least recently listed directories are dropped first when one of the
+     * limits is exceeded.
+     * 
+     * On Linux, the cached directories are watched with inotify, so any change
+     * of a directory or of the files in it invalidates its listings. On other
+     * platforms, the modification time of the directory is checked before a
+     * cached listing is sent. Files that are modified by other processes
+     * (without adding, removing or renaming files) are not noticed there.
+     * 
+     * Must be called before the server is started.
+     * 
+     * @param max_bytes:        The maximum sum of the sizes of the cached listings. 0 disables the cache (default).
+     * @param max_directories:  The maximum number of cached directories. 0 disables the cache (default).
+     */
+    FINEFTP_EXPORT void setDirectoryListingCacheLimits(size_t max_bytes, size_t max_directories);
+
     /**
      * @brief Starts the FTP Server
      * 
@@ -168,6 +394,62 @@ namespace fineftp
      */
     FINEFTP_EXPORT int getOpenConnectionCount() const;
 
+    /**
+     * @brief Returns the number of downloads that found their file in the file cache
+     * 
+     * @see setFileCacheLimits()
+     * 
+     * @return the number of cache hits
+     */
+    FINEFTP_EXPORT uint64_t getFileCacheHitCount() const;
+
+    /**
+     * @brief Returns the number of downloads that had to open their file
+     * 
+     * @see setFileCacheLimits()
+     * 
+     * @return the number of cache misses
+     */
+    FINEFTP_EXPORT uint64_t getFileCacheMissCount() const;
+
+    /**
+     * @brief Returns the number of directory listings that have been sent from the listing cache
+     * 
+     * @see setDirectoryListingCacheLimits()
+     * 
+     * @return the number of cache hits
+     */
+    FINEFTP_EXPORT uint64_t getDirectoryListingCacheHitCount() const;
+
+    /**
+     * @brief Returns the number of directory listings that had to be created
+     * 
+     * @see setDirectoryListingCacheLimits()
+     * 
+     * @return the number of cache misses
+     */
+    FINEFTP_EXPORT uint64_t getDirectoryListingCacheMissCount() const;
+
+    /**
+     * @brief Returns the number of receive buffers that are currently used by uploads
+     * 
+     * Uploads receive their data into buffers from a pool that is shared by
+     * all sessions. Released buffers are reused by later reads.
+     * 
+     * @return the number of receive buffers in use
+     */
+    FINEFTP_EXPORT size_t getReceiveBuffersInUseCount() const;
+
+    /**
+     * @brief Returns the number of receive buffers that are currently allocated
+     * 
+     * This includes the buffers in use and the released buffers that are
+     * kept in the pool for later uploads.
+     * 
+     * @return the number of allocated receive buffers
+     */
+    FINEFTP_EXPORT size_t getReceiveBuffersAllocatedCount() const;
+
     /**
      * @brief Get the control port that the FTP server is listening on
      * 
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+
+namespace fineftp
+{
+  /**
+   * @brief Optional settings of a user
+   *
+   * The settings are passed to FtpServer::addUser() together with the
+   * credentials and permissions of the user. Default constructed settings
+   * don't impose any limits.
+   */
+  struct UserSettings
+  {
+    /** Maximum bandwidth in bytes per second that all transfers of the user share. 0 means unlimited. */
+    std::size_t max_bytes_per_second = 0;
+
+    /**
+     * Share of the user's transfers when the server is busy. Each transfer of
+     * the user may send or receive this many quanta (see
+     * FtpServer::setTransferQuantumSize()) before transfers of other sessions
+     * get their turn. Must not be 0.
+     */
+    unsigned int transfer_weight = 1;
+
+    /**
+     * Drop the files downloaded by the user from the page cache once they
+     * have been sent, no matter how large they are. Useful for users that
+     * stream large files only once (e.g. backups), so they don't push the
+     * files that everyone else needs out of the page cache. See also
+     * FtpServer::setColdStreamingThreshold().
+     */
+    bool cold_streaming = false;
+  };
+}
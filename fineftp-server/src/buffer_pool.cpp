@@ -0,0 +1,70 @@
+#include "buffer_pool.h"
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fineftp
+{
+  BufferPool::BufferPool(std::size_t max_free_bytes)
+    : state_(std::make_shared<State>(max_free_bytes))
+  {}
+
+  std::shared_ptr<std::vector<char>> BufferPool::acquire(std::size_t size)
+  {
+    std::size_t capacity = 1;
+    while (capacity < size)
+      capacity *= 2;
+
+    std::unique_ptr<std::vector<char>> buffer;
+    {
+      const std::lock_guard<std::mutex> lock(state_->mutex);
+      auto free_it = state_->free_buffers.find(capacity);
+      if ((free_it != state_->free_buffers.end()) && !free_it->second.empty())
+      {
+        buffer = std::move(free_it->second.back());
+        free_it->second.pop_back();
+        state_->free_bytes -= capacity;
+        --state_->free_count;
+      }
+      ++state_->in_use_count;
+    }
+
+    // Allocate a new buffer without holding the lock
+    if (!buffer)
+    {
+      buffer = std::make_unique<std::vector<char>>();
+      buffer->reserve(capacity);
+    }
+    buffer->resize(size);
+
+    // The deleter puts the buffer back on the free list. It keeps the state
+    // alive, so the buffer may even outlive the pool.
+    return std::shared_ptr<std::vector<char>>(buffer.release(), [state = state_, capacity](std::vector<char>* released_buffer)
+                                                                {
+                                                                  std::unique_ptr<std::vector<char>> owned_buffer(released_buffer);
+
+                                                                  const std::lock_guard<std::mutex> lock(state->mutex);
+                                                                  --state->in_use_count;
+                                                                  if (state->free_bytes + capacity <= state->max_free_bytes)
+                                                                  {
+                                                                    state->free_buffers[capacity].push_back(std::move(owned_buffer));
+                                                                    state->free_bytes += capacity;
+                                                                    ++state->free_count;
+                                                                  }
+                                                                });
+  }
+
+  std::size_t BufferPool::inUseCount() const
+  {
+    const std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->in_use_count;
+  }
+
+  std::size_t BufferPool::allocatedCount() const
+  {
+    const std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->in_use_count + state_->free_count;
+  }
+}
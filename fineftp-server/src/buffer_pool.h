@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fineftp
+{
+  /**
+   * @brief Recycles the buffers that uploads are received into
+   *
+   * Allocating a fresh buffer for every read from a data socket is
+   * expensive: each large allocation is mapped from the OS, zero-filled,
+   * faulted in and unmapped again when it is freed. The pool keeps released
+   * buffers on free lists and hands them out again, so under load the same
+   * (already faulted-in) memory is reused by all sessions.
+   *
+   * Buffer sizes are rounded up to the next power of two, so buffers of
+   * sessions that use different (but similar) read sizes can be shared.
+   *
+   * The pool never refuses a buffer. If there is no free buffer of the
+   * requested size, a new buffer is allocated. Released buffers are only kept
+   * as long as the free buffers don't exceed max_free_bytes, the others are
+   * freed.
+   *
+   * Buffers may outlive the pool. The pool is thread safe.
+   */
+  class BufferPool
+  {
+  public:
+    /**
+     * @param max_free_bytes  Maximum sum of the sizes of the released buffers that are kept.
+     */
+    explicit BufferPool(std::size_t max_free_bytes);
+
+    // Copy / Move disabled
+    BufferPool(const BufferPool&)            = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    BufferPool(BufferPool&&)                 = delete;
+    BufferPool& operator=(BufferPool&&)      = delete;
+
+    ~BufferPool() = default;
+
+    /**
+     * @brief Returns a buffer of the given size
+     *
+     * The buffer is returned to the pool when the last shared_ptr to it is
+     * released. It may be resized within its capacity, which is the size
+     * rounded up to the next power of two. The content of the buffer is
+     * undefined.
+     *
+     * @param size  The size of the buffer. Must not be 0.
+     */
+    std::shared_ptr<std::vector<char>> acquire(std::size_t size);
+
+    /** @brief Returns the number of buffers that are currently in use */
+    std::size_t inUseCount() const;
+
+    /** @brief Returns the number of buffers that are currently allocated, i.e. in use or free */
+    std::size_t allocatedCount() const;
+
+  private:
+    struct State
+    {
+      explicit State(std::size_t max_free_bytes_)
+        : max_free_bytes(max_free_bytes_)
+        , free_bytes    (0)
+        , free_count    (0)
+        , in_use_count  (0)
+      {}
+
+      const std::size_t max_free_bytes;
+
+      mutable std::mutex                                                         mutex;
+      std::map<std::size_t, std::vector<std::unique_ptr<std::vector<char>>>>     free_buffers;    ///< Free buffers by their capacity
+      std::size_t                                                                free_bytes;
+      std::size_t                                                                free_count;
+      std::size_t                                                                in_use_count;
+    };
+
+    std::shared_ptr<State> state_;    ///< Shared with the deleters of the buffers that are in use
+  };
+}
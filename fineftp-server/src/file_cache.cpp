@@ -0,0 +1,134 @@
+#include "file_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <file_man.h>
+
+#ifdef _WIN32
+  #include "win_str_convert.h"
+#endif // _WIN32
+
+namespace fineftp
+{
+  namespace
+  {
+    std::shared_ptr<ReadableFile> openFile(const std::string& local_path)
+    {
+#if defined(_WIN32) && !defined(__GNUG__)
+      return ReadableFile::get(StrConvert::Utf8ToWide(local_path));
+#else
+      return ReadableFile::get(local_path);
+#endif
+    }
+  }  // namespace
+
+  FileCache::FileCache(std::size_t max_total_file_size, std::size_t max_entries)
+    : max_total_file_size_(max_total_file_size)
+    , max_entries_        (max_entries)
+    , total_file_size_    (0)
+    , hit_count_          (0)
+    , miss_count_         (0)
+  {}
+
+  std::shared_ptr<ReadableFile> FileCache::get(const std::string& local_path)
+  {
+    if ((max_total_file_size_ == 0) || (max_entries_ == 0))
+      return openFile(local_path);
+
+    std::shared_ptr<ReadableFile> cached_file;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      auto entry_it = entries_.find(local_path);
+      if (entry_it != entries_.end())
+      {
+        lru_.splice(lru_.begin(), lru_, entry_it->second);
+        cached_file = entry_it->second->file;
+      }
+    }
+
+    // The file may have been replaced or modified by someone else than the
+    // server. Checking that is a cheap stat and done without holding the lock.
+    if (cached_file)
+    {
+      if (cached_file->isUpToDate())
+      {
+        hit_count_++;
+        return cached_file;
+      }
+      erase(local_path, cached_file);
+    }
+
+    // Open the file without holding the lock, as that may take a while
+    miss_count_++;
+    auto file = openFile(local_path);
+    if (!file || (file->size() > max_total_file_size_))
+      return file;
+
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.find(local_path) == entries_.end())
+    {
+      lru_.push_front(Entry{local_path, file});
+      entries_.emplace(local_path, lru_.begin());
+      total_file_size_ += file->size();
+      evict();
+    }
+    return file;
+  }
+
+  void FileCache::invalidate(const std::string& local_path)
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    auto entry_it = entries_.find(local_path);
+    if (entry_it != entries_.end())
+    {
+      total_file_size_ -= entry_it->second->file->size();
+      lru_.erase(entry_it->second);
+      entries_.erase(entry_it);
+    }
+  }
+
+  void FileCache::clear()
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    entries_.clear();
+    total_file_size_ = 0;
+  }
+
+  std::uint64_t FileCache::hitCount() const
+  {
+    return hit_count_;
+  }
+
+  std::uint64_t FileCache::missCount() const
+  {
+    return miss_count_;
+  }
+
+  void FileCache::erase(const std::string& local_path, const std::shared_ptr<ReadableFile>& file)
+  {
+    // Only erase the entry, if no other thread has replaced it in the meantime
+    const std::lock_guard<std::mutex> lock(mutex_);
+    auto entry_it = entries_.find(local_path);
+    if ((entry_it != entries_.end()) && (entry_it->second->file == file))
+    {
+      total_file_size_ -= file->size();
+      lru_.erase(entry_it->second);
+      entries_.erase(entry_it);
+    }
+  }
+
+  void FileCache::evict()
+  {
+    while (!lru_.empty() && ((total_file_size_ > max_total_file_size_) || (lru_.size() > max_entries_)))
+    {
+      total_file_size_ -= lru_.back().file->size();
+      entries_.erase(lru_.back().local_path);
+      lru_.pop_back();
+    }
+  }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <file_man.h>
+
+namespace fineftp
+{
+  /**
+   * @brief Keeps recently downloaded files open
+   *
+   * ReadableFile::get() only shares a file among the transfers that are
+   * running at the same time. Once the last transfer has finished, the file
+   * is closed and the next download has to open it again. The cache keeps
+   * references to the most recently used files, so they stay open (together
+   * with their file mapping on Windows) after their last transfer.
+   *
+   * The cache is bounded by the number of files and by the sum of their
+   * sizes. The least recently used files are dropped first. Files that are
+   * larger than the size limit are never cached. With a limit of 0 the cache
+   * is disabled and get() is equivalent to ReadableFile::get().
+   *
+   * The size limit is not a memory budget. A cached file only holds its
+   * handle (and the file mapping object on Windows). The windows that are
+   * mapped for sending are owned by the transfers and unmapped when they
+   * are done, whether the file is cached or not. The limit bounds how much
+   * data cached files keep pinned on the disk after they have been removed.
+   *
+   * Cached files are validated with a stat before they are served (see
+   * ReadableFile::isUpToDate()), so files that have been replaced or modified
+   * by other processes are opened again. Sessions invalidate() the files
+   * they modify or remove, so those are closed right away.
+   *
+   * The cache is thread safe.
+   */
+  class FileCache
+  {
+  public:
+    /**
+     * @param max_total_file_size  Maximum sum of the sizes of the cached files.
+     * @param max_entries          Maximum number of cached files.
+     */
+    FileCache(std::size_t max_total_file_size, std::size_t max_entries);
+
+    // Copy / Move disabled
+    FileCache(const FileCache&)            = delete;
+    FileCache& operator=(const FileCache&) = delete;
+    FileCache(FileCache&&)                 = delete;
+    FileCache& operator=(FileCache&&)      = delete;
+
+    ~FileCache() = default;
+
+    /**
+     * @brief Returns the file at the given path, either from the cache or freshly opened
+     *
+     * @param local_path  The (UTF-8 encoded) local path of the file.
+     *
+     * @return The file or nullptr, if the file could not be opened.
+     */
+    std::shared_ptr<ReadableFile> get(const std::string& local_path);
+
+    /**
+     * @brief Drops the file at the given path from the cache
+     *
+     * @param local_path  The (UTF-8 encoded) local path of the file.
+     */
+    void invalidate(const std::string& local_path);
+
+    /**
+     * @brief Drops all files from the cache
+     *
+     * Used when a directory is renamed, as the files below it may still be
+     * open. Windows does not allow renaming a directory that contains open
+     * files.
+     */
+    void clear();
+
+    /** @brief Returns the number of requests that have been served from the cache */
+    std::uint64_t hitCount() const;
+
+    /** @brief Returns the number of requests that had to open the file */
+    std::uint64_t missCount() const;
+
+  private:
+    struct Entry
+    {
+      std::string                   local_path;
+      std::shared_ptr<ReadableFile> file;
+    };
+
+    void erase(const std::string& local_path, const std::shared_ptr<ReadableFile>& file);
+    void evict();
+
+  private:
+    const std::size_t max_total_file_size_;
+    const std::size_t max_entries_;
+
+    std::mutex                                                     mutex_;
+    std::list<Entry>                                               lru_;        ///< Most recently used file first
+    std::unordered_map<std::string, std::list<Entry>::iterator>    entries_;
+    std::size_t                                                    total_file_size_;
+
+    std::atomic<std::uint64_t> hit_count_;
+    std::atomic<std::uint64_t> miss_count_;
+  };
+}
@@ -0,0 +1,116 @@
+#include "file_prefetcher.h"
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <file_man.h>
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+  #include <algorithm>
+
+  #include <file_io_uring.h>
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+namespace fineftp
+{
+  FilePrefetcher::FilePrefetcher(std::size_t thread_count, std::size_t chunk_size)
+    : chunk_size_ (chunk_size)
+    , thread_pool_(thread_count)
+  {}
+
+  FilePrefetcher::~FilePrefetcher()
+  {
+    thread_pool_.join();
+  }
+
+  void FilePrefetcher::load(const std::shared_ptr<ReadableFile>& file, std::size_t offset, const LoadedHandler& handler)
+  {
+    const std::size_t chunk_offset = offset - (offset % chunk_size_);
+    const ChunkKey    chunk_key(file.get(), chunk_offset);
+
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      auto loading_it = loading_.find(chunk_key);
+      if (loading_it != loading_.end())
+      {
+        // Somebody is loading the chunk already
+        if (handler)
+          loading_it->second.push_back(handler);
+        return;
+      }
+
+      auto& handlers = loading_[chunk_key];
+      if (handler)
+        handlers.push_back(handler);
+    }
+
+    // The file is captured, so its address (which is part of the key) cannot
+    // be reused while the chunk is being loaded.
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    if (io_uring_ != nullptr)
+    {
+      const std::shared_ptr<std::vector<char>> buffer = io_uring_->acquireBuffer();
+      if (buffer)
+      {
+        readChunk(file, chunk_key, buffer, chunk_key.second);
+        return;
+      }
+    }
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+    asio::post(thread_pool_, [this, file, chunk_key]()
+                             {
+                               file->load(chunk_key.second, chunk_size_);
+                               finishLoading(chunk_key);
+                             });
+  }
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+  void FilePrefetcher::setIoUring(FileIoUring* io_uring)
+  {
+    io_uring_ = io_uring;
+  }
+
+  void FilePrefetcher::readChunk(const std::shared_ptr<ReadableFile>& file, const ChunkKey& chunk_key, const std::shared_ptr<std::vector<char>>& buffer, std::size_t offset)
+  {
+    // The chunk is read piece by piece into the same buffer. The data is
+    // not needed, reading it only brings it into the page cache.
+    const std::size_t chunk_end = (std::min)(chunk_key.second + chunk_size_, file->size());
+    if (offset >= chunk_end)
+    {
+      finishLoading(chunk_key);
+      return;
+    }
+
+    buffer->resize((std::min)(buffer->capacity(), chunk_end - offset));
+    io_uring_->asyncRead(file->handle(), buffer, offset
+                       , [this, file, chunk_key, buffer, offset](int result)
+                         {
+                           // Errors (and a truncated file) are found out by the transfer
+                           if (result <= 0)
+                             finishLoading(chunk_key);
+                           else
+                             readChunk(file, chunk_key, buffer, offset + static_cast<std::size_t>(result));
+                         });
+  }
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+  void FilePrefetcher::finishLoading(const ChunkKey& chunk_key)
+  {
+    std::vector<LoadedHandler> handlers;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      auto loading_it = loading_.find(chunk_key);
+      handlers = std::move(loading_it->second);
+      loading_.erase(loading_it);
+    }
+
+    for (const auto& loaded_handler : handlers)
+      loaded_handler();
+  }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <file_man.h>
+
+namespace fineftp
+{
+#ifdef FINEFTP_SERVER_USE_IO_URING
+  class FileIoUring;
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+  /**
+   * @brief Reads files into the page cache on helper threads
+   *
+   * Sending a file that is not in the page cache blocks the sending thread
+   * on disk I/O (e.g. page faults of a mapped file or sendfile() waiting for
+   * the disk). Blocking an io thread also stalls every other connection that
+   * is served by it. Transfers therefore check which part of the file is
+   * resident (see ReadableFile::residentSize()) and let the prefetcher load
+   * the rest on one of its own threads.
+   *
+   * Files are loaded in chunks. Concurrent requests for the same chunk of the
+   * same file are merged.
+   *
+   * With an io_uring (see setIoUring()), the chunks are read by the kernel
+   * asynchronously into one of the ring's registered buffers and no helper
+   * thread waits for the disk. The data is only read to warm the page cache,
+   * the file is still sent from there without copying it.
+   *
+   * The prefetcher is thread safe.
+   */
+  class FilePrefetcher
+  {
+  public:
+    /** Called from a helper thread (or an io thread, see setIoUring()) once the chunk has been loaded. Must not block. */
+    using LoadedHandler = std::function<void()>;
+
+    /**
+     * @param thread_count  Number of helper threads.
+     * @param chunk_size    Number of bytes that are loaded at once.
+     */
+    FilePrefetcher(std::size_t thread_count, std::size_t chunk_size);
+
+    // Copy / Move disabled
+    FilePrefetcher(const FilePrefetcher&)            = delete;
+    FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+    FilePrefetcher(FilePrefetcher&&)                 = delete;
+    FilePrefetcher& operator=(FilePrefetcher&&)      = delete;
+
+    /** Waits for the loads that are in progress */
+    ~FilePrefetcher();
+
+    /**
+     * @brief Loads the chunk of the file that contains the given offset
+     *
+     * @param file      The file to load.
+     * @param offset    An offset in the chunk to load.
+     * @param handler   Called when the chunk has been loaded. May be empty.
+     */
+    void load(const std::shared_ptr<ReadableFile>& file, std::size_t offset, const LoadedHandler& handler);
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    /**
+     * @brief Loads the chunks through the given ring instead of the helper threads
+     *
+     * Chunks are still loaded by the helper threads, while all registered
+     * buffers of the ring are in use. Must be called before the first load().
+     *
+     * @param io_uring  The ring. Must outlive the prefetcher. nullptr to use the helper threads only.
+     */
+    void setIoUring(FileIoUring* io_uring);
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+  private:
+    using ChunkKey = std::pair<const ReadableFile*, std::size_t>;
+
+    void finishLoading(const ChunkKey& chunk_key);
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    void readChunk(const std::shared_ptr<ReadableFile>& file, const ChunkKey& chunk_key, const std::shared_ptr<std::vector<char>>& buffer, std::size_t offset);
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+    const std::size_t chunk_size_;
+
+    std::mutex                                     mutex_;
+    std::map<ChunkKey, std::vector<LoadedHandler>> loading_;    ///< Chunks being loaded and the handlers waiting for them
+
+    asio::thread_pool thread_pool_;
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    FileIoUring*      io_uring_ = nullptr;
+#endif // FINEFTP_SERVER_USE_IO_URING
+  };
+}
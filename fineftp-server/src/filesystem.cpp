@@ -14,6 +14,7 @@
 #include <map>
 #include <regex>
 #include <string>
+#include <utility>
 
 #include <sys/stat.h>
 
@@ -39,6 +40,11 @@
 #include <cerrno>
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+  #include <sys/sysmacros.h> // makedev
+#endif // __linux__
 
 #endif // _WIN32
 
@@ -64,6 +70,70 @@ namespace Filesystem
     is_ok_ = (error_code == 0);
   }
 
+  FileStatus::FileStatus(const std::string& path, FileType type)
+    : path_(path)
+    , is_ok_(true)
+    , file_status_{}
+  {
+    switch (type)
+    {
+    case FileType::RegularFile:     file_status_.st_mode = S_IFREG;  break;
+    case FileType::Dir:             file_status_.st_mode = S_IFDIR;  break;
+    case FileType::CharacterDevice: file_status_.st_mode = S_IFCHR;  break;
+#ifndef _WIN32
+    case FileType::BlockDevice:     file_status_.st_mode = S_IFBLK;  break;
+    case FileType::Fifo:            file_status_.st_mode = S_IFIFO;  break;
+    case FileType::SymbolicLink:    file_status_.st_mode = S_IFLNK;  break;
+    case FileType::Socket:          file_status_.st_mode = S_IFSOCK; break;
+#endif // !_WIN32
+    default:                        is_ok_ = false;                  break;
+    }
+  }
+
+#ifndef _WIN32
+  FileStatus::FileStatus(int dir_fd, const std::string& name, const std::string& path)
+    : path_(path)
+    , file_status_{}
+  {
+#if defined(__linux__) && defined(STATX_BASIC_STATS)
+    // Only request what the listings need. AT_STATX_DONT_SYNC lets network
+    // filesystems answer from their attribute cache.
+    struct statx statx_buffer{};
+    const int statx_error_code = statx(dir_fd
+                                     , name.c_str()
+                                     , AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC
+                                     , STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_INO
+                                     , &statx_buffer);
+    if (statx_error_code == 0)
+    {
+      file_status_.st_mode          = statx_buffer.stx_mode;
+      file_status_.st_size          = static_cast<off_t>(statx_buffer.stx_size);
+      file_status_.st_ino           = statx_buffer.stx_ino;
+      file_status_.st_dev           = makedev(statx_buffer.stx_dev_major, statx_buffer.stx_dev_minor);
+      file_status_.st_mtim.tv_sec   = statx_buffer.stx_mtime.tv_sec;
+      file_status_.st_mtim.tv_nsec  = statx_buffer.stx_mtime.tv_nsec;
+      is_ok_ = true;
+      return;
+    }
+    else if (errno != ENOSYS)
+    {
+      is_ok_ = false;
+      return;
+    }
+    // The kernel does not support statx, so we fall back to fstatat
+#endif // __linux__ && STATX_BASIC_STATS
+
+#ifdef AT_NO_AUTOMOUNT
+    const int flags = AT_NO_AUTOMOUNT;
+#else // AT_NO_AUTOMOUNT
+    const int flags = 0;
+#endif // AT_NO_AUTOMOUNT
+
+    const int error_code = fstatat(dir_fd, name.c_str(), &file_status_, flags);
+    is_ok_ = (error_code == 0);
+  }
+#endif // !_WIN32
+
   bool FileStatus::isOk() const
   {
     return is_ok_;
@@ -343,6 +413,45 @@ namespace Filesystem
     return date.str();
   }
   
+  std::string FileStatus::uniqueId() const
+  {
+    if (!is_ok_)
+      return "";
+
+    std::stringstream unique_id;
+    unique_id << std::hex;
+
+#ifdef _WIN32
+    // The POSIX API does not return an inode number on Windows, so we query
+    // the volume serial number and the file index instead
+    const std::wstring w_path = StrConvert::Utf8ToWide(path_);
+    HANDLE file_handle = CreateFileW(w_path.c_str()
+                              , 0
+                              , FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE
+                              , NULL
+                              , OPEN_EXISTING
+                              , FILE_FLAG_BACKUP_SEMANTICS // Required for opening directories
+                              , NULL);
+
+    if (file_handle == INVALID_HANDLE_VALUE)
+      return "";
+
+    BY_HANDLE_FILE_INFORMATION file_info{};
+    const BOOL success = GetFileInformationByHandle(file_handle, &file_info);
+    CloseHandle(file_handle);
+
+    if (!success)
+      return "";
+
+    unique_id << file_info.dwVolumeSerialNumber << "U"
+              << ((static_cast<uint64_t>(file_info.nFileIndexHigh) << 32) | file_info.nFileIndexLow);
+#else // _WIN32
+    unique_id << static_cast<uint64_t>(file_status_.st_dev) << "U" << static_cast<uint64_t>(file_status_.st_ino);
+#endif // _WIN32
+
+    return unique_id.str();
+  }
+
   bool FileStatus::canOpenDir() const
   {
     if (!is_ok_)
@@ -378,47 +487,130 @@ namespace Filesystem
     return can_open_dir;
   }
 
-  std::map<std::string, FileStatus> dirContent(const std::string& path, std::ostream& error)
+#ifdef _WIN32
+  namespace
+  {
+    FileType fileTypeFromAttributes(DWORD attributes)
+    {
+      // Reparse points (e.g. symbolic links) have to be followed to get the type of their target
+      if ((attributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0)
+        return FileType::Unknown;
+      return ((attributes & FILE_ATTRIBUTE_DIRECTORY) != 0) ? FileType::Dir : FileType::RegularFile;
+    }
+  }
+#endif // _WIN32
+
+  DirectoryReader::DirectoryReader(const std::string& path, std::ostream& error)
+    : path_(path)
+#ifdef _WIN32
+    , find_handle_  (INVALID_HANDLE_VALUE)
+    , has_next_name_(false)
+    , next_type_    (FileType::Unknown)
+#else // _WIN32
+    , dir_(nullptr)
+#endif // _WIN32
   {
-    std::map<std::string, FileStatus> content;
 #ifdef _WIN32
     std::string find_file_path = path + "\\*";
     std::replace(find_file_path.begin(), find_file_path.end(), '/', '\\');
 
     const std::wstring w_find_file_path = StrConvert::Utf8ToWide(find_file_path);
 
-    HANDLE hFind = nullptr;
     WIN32_FIND_DATAW ffd;
-    hFind = FindFirstFileW(w_find_file_path.c_str(), &ffd);
-    if (hFind == INVALID_HANDLE_VALUE)
+    find_handle_ = FindFirstFileW(w_find_file_path.c_str(), &ffd);
+    if (find_handle_ == INVALID_HANDLE_VALUE)
     {
       error << "FindFirstFile Error" << std::endl;
-      return content;
+      return;
     }
 
-    do
+    has_next_name_ = true;
+    next_name_     = StrConvert::WideToUtf8(std::wstring(ffd.cFileName));
+    next_type_     = fileTypeFromAttributes(ffd.dwFileAttributes);
+#else // _WIN32
+    dir_ = opendir(path.c_str());
+    if (dir_ == nullptr)
     {
-      const std::string file_name = StrConvert::WideToUtf8(std::wstring(ffd.cFileName));
-      content.emplace(file_name, FileStatus(path + "\\" + file_name));
-    } while (FindNextFileW(hFind, &ffd) != 0);
-    FindClose(hFind);
+      error << "Error opening directory: " << strerror(errno) << std::endl;
+    }
+#endif // _WIN32
+  }
+
+  DirectoryReader::~DirectoryReader()
+  {
+#ifdef _WIN32
+    if (find_handle_ != INVALID_HANDLE_VALUE)
+      FindClose(find_handle_);
+#else // _WIN32
+    if (dir_ != nullptr)
+      closedir(static_cast<DIR*>(dir_));
+#endif // _WIN32
+  }
+
+  bool DirectoryReader::isOk() const
+  {
+#ifdef _WIN32
+    return (find_handle_ != INVALID_HANDLE_VALUE);
 #else // _WIN32
-    DIR *dp = opendir(path.c_str());
-    struct dirent *dirp = nullptr;
-    if(dp == nullptr)
+    return (dir_ != nullptr);
+#endif // _WIN32
+  }
+
+  bool DirectoryReader::next(std::string& name, FileType& type)
+  {
+#ifdef _WIN32
+    if (!has_next_name_)
+      return false;
+
+    name = std::move(next_name_);
+    type = next_type_;
+
+    // Look ahead, as FindFirstFileW already returned the first entry
+    WIN32_FIND_DATAW ffd;
+    has_next_name_ = (FindNextFileW(find_handle_, &ffd) != 0);
+    if (has_next_name_)
     {
-        error << "Error opening directory: " << strerror(errno) << std::endl;
-        return content;
+      next_name_ = StrConvert::WideToUtf8(std::wstring(ffd.cFileName));
+      next_type_ = fileTypeFromAttributes(ffd.dwFileAttributes);
     }
 
-    while ((dirp = readdir(dp)) != nullptr)
+    return true;
+#else // _WIN32
+    if (dir_ == nullptr)
+      return false;
+
+    const struct dirent* dirp = readdir(static_cast<DIR*>(dir_));
+    if (dirp == nullptr)
+      return false;
+
+    name = dirp->d_name;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+    switch (dirp->d_type)
     {
-      content.emplace(std::string(dirp->d_name), FileStatus(path + "/" + std::string(dirp->d_name)));
+    case DT_REG:  type = FileType::RegularFile;     break;
+    case DT_DIR:  type = FileType::Dir;             break;
+    case DT_CHR:  type = FileType::CharacterDevice; break;
+    case DT_BLK:  type = FileType::BlockDevice;     break;
+    case DT_FIFO: type = FileType::Fifo;            break;
+    case DT_SOCK: type = FileType::Socket;          break;
+    default:      type = FileType::Unknown;         break; // DT_UNKNOWN and DT_LNK, which has to be followed
     }
-    closedir(dp);
+#else // _DIRENT_HAVE_D_TYPE
+    type = FileType::Unknown;
+#endif // _DIRENT_HAVE_D_TYPE
 
+    return true;
+#endif // _WIN32
+  }
+
+  FileStatus DirectoryReader::status(const std::string& name) const
+  {
+#ifdef _WIN32
+    return FileStatus(path_ + "\\" + name);
+#else // _WIN32
+    return FileStatus(dirfd(static_cast<DIR*>(dir_)), name, path_ + "/" + name);
 #endif // _WIN32
-    return content;
   }
 
   std::string cleanPath(const std::string& path, bool path_is_windows_path, const char output_separator)
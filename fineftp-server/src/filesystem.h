@@ -1,7 +1,6 @@
 #pragma once
 
 #include <cstdint>
-#include <map>
 #include <string>
 #include <iostream>
 
@@ -32,6 +31,31 @@ namespace fineftp
     public:
       FileStatus(const std::string& path);
 
+      /**
+       * @brief Creates a status that only knows the type of the file
+       *
+       * Used when the type is already known from the directory entry, so the
+       * file does not have to be stat'ed. All other properties have their
+       * default values.
+       */
+      FileStatus(const std::string& path, FileType type);
+
+#ifndef _WIN32
+      /**
+       * @brief Queries the status of an entry of an open directory
+       *
+       * The entry is looked up relative to the directory, instead of walking
+       * the entire path again. On Linux, only the fields needed for listings
+       * are requested and cached attributes are accepted, which saves a round
+       * trip to the server on network filesystems.
+       *
+       * @param dir_fd: File descriptor of the directory
+       * @param name:   Name of the entry
+       * @param path:   Full path of the entry
+       */
+      FileStatus(int dir_fd, const std::string& name, const std::string& path);
+#endif // !_WIN32
+
       bool isOk() const;
       FileType type() const;
 
@@ -57,6 +81,9 @@ namespace fineftp
 
       std::string generalizedTimeString() const;
 
+      /** Identifier of the file that is the same for all paths leading to it (e.g. hardlinks), as used by the "unique" fact of MLSD and MLST */
+      std::string uniqueId() const;
+
       bool canOpenDir() const;
 
 
@@ -71,7 +98,57 @@ namespace fineftp
   #endif 
     };
 
-    std::map<std::string, FileStatus> dirContent(const std::string& path, std::ostream& error);
+    /**
+     * @brief Enumerates the entries of a directory one by one
+     *
+     * Unlike collecting the whole directory content at once, the memory
+     * usage does not depend on the number of entries, so even directories with
+     * millions of entries can be listed in small batches. The entries are
+     * returned in the order of the filesystem, i.e. unsorted. This includes
+     * the "." and ".." entries.
+     */
+    class DirectoryReader
+    {
+    public:
+      DirectoryReader(const std::string& path, std::ostream& error);
+      ~DirectoryReader();
+
+      // Copy / Move disabled
+      DirectoryReader(const DirectoryReader&)            = delete;
+      DirectoryReader& operator=(const DirectoryReader&) = delete;
+      DirectoryReader(DirectoryReader&&)                 = delete;
+      DirectoryReader& operator=(DirectoryReader&&)      = delete;
+
+      /** Returns whether the directory could be opened */
+      bool isOk() const;
+
+      /**
+       * @brief Reads the name of the next entry
+       *
+       * @param name: Set to the name of the next entry
+       * @param type: Set to the type of the next entry, if the directory
+       *              already knows it (d_type). FileType::Unknown otherwise.
+       *              Symbolic links are reported as Unknown, as their status
+       *              is the one of their target.
+       *
+       * @return false, if there are no more entries
+       */
+      bool next(std::string& name, FileType& type);
+
+      /** Returns the status of the entry with the given name */
+      FileStatus status(const std::string& name) const;
+
+    private:
+      std::string path_;
+#ifdef _WIN32
+      void*       find_handle_;      // HANDLE of FindFirstFileW
+      bool        has_next_name_;
+      std::string next_name_;        // Already found by FindFirstFileW / FindNextFileW
+      FileType    next_type_;
+#else // _WIN32
+      void*       dir_;              // DIR* of opendir
+#endif // _WIN32
+    };
 
     std::string cleanPath(const std::string& path, bool path_is_windows_path, char output_separator);
 
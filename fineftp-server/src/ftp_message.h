@@ -51,6 +51,7 @@ namespace fineftp
     ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE = 452,
     FILE_ACTION_ABORTED                         = 552,
     ACTION_NOT_TAKEN_FILENAME_NOT_ALLOWED       = 553,
+    ACTION_NOT_TAKEN_INVALID_REST_PARAMETER     = 554,
   };
 
   class FtpMessage
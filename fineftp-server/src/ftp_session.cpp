@@ -3,11 +3,16 @@
 #include <asio.hpp>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert> // assert
 #include <cctype>  // std::iscntrl, toupper
+#include <cerrno>
 #include <chrono>   // IWYU pragma: keep (it is used for special preprocessor defines)
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <functional>
 #include <iomanip>
@@ -20,13 +25,16 @@
 #include <sstream>
 #include <string>
 #include <sys/types.h>
+#include <utility>
 #include <vector>
 
 #include <file_man.h>
 
 #include "filesystem.h"
 #include "ftp_message.h"
+#include "token_bucket.h"
 #include "user_database.h"
+#include <fineftp/durability.h>
 #include <fineftp/permissions.h>
 
 #include <sys/stat.h>
@@ -42,21 +50,57 @@
   #include <unistd.h>
 #endif // _WIN32
 
+#ifdef __linux__
+  #include <fcntl.h>
+  #include <sys/sendfile.h>
+#endif // __linux__
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+  #include <file_io_uring.h>
+#endif // FINEFTP_SERVER_USE_IO_URING
+
 
 namespace fineftp
 {
+  namespace
+  {
+    // The facts of MLSD and MLST listings that we support. All of them are
+    // enabled by default and can be selected with OPTS MLST.
+    const std::array<std::string, 5> supported_mlst_facts = { "type", "size", "modify", "perm", "unique" };
+
+    // Directory listings are formatted and sent in batches of this many
+    // entries, so only the names of a big directory are held in memory as a
+    // whole, but not its formatted listing.
+    constexpr std::size_t listing_batch_size = 512;
 
-  FtpSession::FtpSession(asio::io_context& io_context, const UserDatabase& user_database, const std::function<void()>& completion_handler, std::ostream& output, std::ostream& error)
+    // The entries of a batch are only stat'ed in parallel, if each thread
+    // gets at least this many of them
+    constexpr std::size_t listing_min_entries_per_thread = 32;
+  }
+
+  FtpSession::FtpSession(asio::io_context& io_context, const UserDatabase& user_database, ServerContext& server_context, const std::function<void()>& completion_handler, std::ostream& output, std::ostream& error)
     : completion_handler_   (completion_handler)
     , user_database_        (user_database)
+    , transfer_weight_      (1)
+    , user_cold_streaming_  (false)
+    , server_context_       (server_context)
     , io_context_           (io_context)
     , command_strand_       (io_context)
     , command_socket_       (io_context)
+    , restart_offset_       (0)
+    , allocation_size_      (0)
+    , mlst_facts_           (supported_mlst_facts.begin(), supported_mlst_facts.end())
     , data_type_binary_     (false)
     , shutdown_requested_   (false)
     , ftp_working_directory_("/")
     , data_acceptor_        (io_context)
     , data_socket_strand_   (io_context)
+    , file_writes_in_flight_(0)
+    , file_write_error_     (0)
+    , receive_error_        ()
+    , receive_buffer_size_  (server_context.settings.min_receive_buffer_size)
+    , receive_rate_         (0)
+    , durable_uploads_      (0)
     , timer_                (io_context)
     , output_               (output)
     , error_                (error)
@@ -117,7 +161,9 @@ namespace fineftp
 
   void FtpSession::sendRawFtpMessage(const std::string& raw_message)
   {
-    asio::post(command_strand_, [me = shared_from_this(), raw_message]()
+    // Replies to commands are queued right away, so they keep their order with
+    // the completion of previous replies (that is relevant for QUIT).
+    asio::dispatch(command_strand_, [me = shared_from_this(), raw_message]()
                          {
                            const bool write_in_progress = !me->command_output_queue_.empty();
                            me->command_output_queue_.push_back(raw_message);
@@ -143,8 +189,10 @@ namespace fineftp
                         {
                           me->command_output_queue_.pop_front();
 
-                          // Handle the QUIT command
-                          if (me->shutdown_requested_)
+                          // Handle the QUIT command. The QUIT command may have been
+                          // handled while a previous reply was still being sent, so
+                          // we only close the socket after the last reply.
+                          if (me->shutdown_requested_ && me->command_output_queue_.empty())
                           {
                             // Properly close command socket
                             asio::error_code ec_;
@@ -269,7 +317,9 @@ namespace fineftp
       { "FEAT", std::bind(&FtpSession::handleFtpCommandFEAT, this, std::placeholders::_1) },
       { "OPTS", std::bind(&FtpSession::handleFtpCommandOPTS, this, std::placeholders::_1) },
       { "SIZE", std::bind(&FtpSession::handleFtpCommandSIZE, this, std::placeholders::_1) },
-      { "MDTM", std::bind(&FtpSession::handleFtpCommandMDTM, this, std::placeholders::_1) }
+      { "MDTM", std::bind(&FtpSession::handleFtpCommandMDTM, this, std::placeholders::_1) },
+      { "MLSD", std::bind(&FtpSession::handleFtpCommandMLSD, this, std::placeholders::_1) },
+      { "MLST", std::bind(&FtpSession::handleFtpCommandMLST, this, std::placeholders::_1) }
     };
 
     auto command_it = command_map.find(ftp_command);
@@ -300,8 +350,13 @@ namespace fineftp
   void FtpSession::handleFtpCommandUSER(const std::string& param)
   {
     logged_in_user_        = nullptr;
+    user_bandwidth_limit_  = nullptr;
+    transfer_weight_       = 1;
+    user_cold_streaming_   = false;
     username_for_login_    = param;
     ftp_working_directory_ = "/";
+    restart_offset_        = 0;
+    allocation_size_       = 0;
 
     if (param.empty())
     {
@@ -327,7 +382,10 @@ namespace fineftp
       auto user = user_database_.getUser(username_for_login_, param);
       if (user)
       {
-        logged_in_user_ = user;
+        logged_in_user_       = user;
+        user_bandwidth_limit_ = user->bandwidth_limit_;
+        transfer_weight_      = user->transfer_weight_;
+        user_cold_streaming_  = user->cold_streaming_;
         sendFtpMessage(FtpReplyCode::USER_LOGGED_IN, "Login successful");
         return;
       }
@@ -539,13 +597,12 @@ namespace fineftp
       return;
     }
 
+    // The restart offset only applies to the next transfer
+    const std::uint64_t restart_offset = restart_offset_;
+    restart_offset_ = 0;
+
     const std::string local_path = toLocalPath(param);
-    
-#if defined(_WIN32) && !defined(__GNUG__)
-    const auto file = ReadableFile::get(StrConvert::Utf8ToWide(local_path));
-#else
-    const auto file = ReadableFile::get(local_path);
-#endif
+    const auto        file       = server_context_.file_cache->get(local_path);
 
     if (!file)
     {
@@ -553,8 +610,14 @@ namespace fineftp
       return;
     }
 
+    if (restart_offset > file->size())
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INVALID_REST_PARAMETER, "Restart offset exceeds the file size");
+      return;
+    }
+
     sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending file");
-    sendFile(file);
+    sendFile(file, static_cast<std::size_t>(restart_offset));
   }
 
   void FtpSession::handleFtpCommandSIZE(const std::string& param)
@@ -616,6 +679,18 @@ namespace fineftp
       return;
     }
 
+    // The restart offset and allocation size only apply to the next transfer
+    const std::uint64_t restart_offset = restart_offset_;
+    restart_offset_ = 0;
+    const std::uint64_t allocation_size = allocation_size_;
+    allocation_size_ = 0;
+
+    if (restart_offset > 0)
+    {
+      resumeFileUpload(param, restart_offset, allocation_size);
+      return;
+    }
+
     // TODO: the ACTION_NOT_TAKEN reply is not RCF 959 conform. Apparently in
     // 1985 nobody anticipated that you might not want anybody uploading files
     // to your server. We use the return code anyways, as the popular FileZilla
@@ -649,8 +724,11 @@ namespace fineftp
       }
     }
 
+    server_context_.file_cache->invalidate(local_path);
+    server_context_.listing_cache->invalidate(local_path);
+
     const std::ios::openmode open_mode = (data_type_binary_ ? std::ios::binary : std::ios::openmode{});
-    const std::shared_ptr<WriteableFile> file = std::make_shared<WriteableFile>(local_path, open_mode);
+    const std::shared_ptr<WriteableFile> file = createUploadFile(local_path, open_mode);
 
     if (!file->good())
     {
@@ -663,8 +741,11 @@ namespace fineftp
       return;
     }
 
+    if (!preallocateUpload(file, allocation_size))
+      return;
+
     sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Receiving file");
-    receiveFile(file);
+    receiveFile(file, allocation_size);
   }
 
   void FtpSession::handleFtpCommandSTOU(const std::string& /*param*/)
@@ -675,6 +756,11 @@ namespace fineftp
       return;
     }
 
+    // A unique file is always created from scratch
+    restart_offset_ = 0;
+    const std::uint64_t allocation_size = allocation_size_;
+    allocation_size_ = 0;
+
     if (static_cast<int>(logged_in_user_->permissions_ & Permission::FileWrite) == 0)
     {
       sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
@@ -711,7 +797,7 @@ namespace fineftp
       }
 
       // Create a file with that filename
-      const std::shared_ptr<WriteableFile> file = std::make_shared<WriteableFile>(absolute_file_path, open_mode);
+      const std::shared_ptr<WriteableFile> file = createUploadFile(absolute_file_path, open_mode);
 
       if (!file->good())
       {
@@ -725,8 +811,11 @@ namespace fineftp
         return;
       }
 
+      if (!preallocateUpload(file, allocation_size))
+        return;
+
       sendFtpMessage(FtpReplyCode::DATA_CONNECTION_OPEN_TRANSFER_STARTING, "FILE: " + unique_file_name);
-      receiveFile(file);
+      receiveFile(file, allocation_size);
       return;
     }
 
@@ -742,6 +831,11 @@ namespace fineftp
       return;
     }
 
+    // Appending always starts at the end of the file
+    restart_offset_ = 0;
+    const std::uint64_t allocation_size = allocation_size_;
+    allocation_size_ = 0;
+
     // Check whether the file exists. This determines whether we need Append or Write Permissions
     const std::string local_path = toLocalPath(param);
     auto existing_file_filestatus = Filesystem::FileStatus(local_path);
@@ -785,6 +879,9 @@ namespace fineftp
     else
       open_mode = (data_type_binary_ ? (std::ios::binary) : std::ios::openmode{});
 
+    server_context_.file_cache->invalidate(local_path);
+    server_context_.listing_cache->invalidate(local_path);
+
     const std::shared_ptr<WriteableFile> file = std::make_shared<WriteableFile>(local_path, open_mode);
 
     if (!file->good())
@@ -797,18 +894,161 @@ namespace fineftp
       return;
     }
 
+    if (!preallocateUpload(file, allocation_size))
+      return;
+
     sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Receiving file");
-    receiveFile(file);
+    receiveFile(file, allocation_size);
   }
 
-  void FtpSession::handleFtpCommandALLO(const std::string& /*param*/)
+  void FtpSession::resumeFileUpload(const std::string& param, std::uint64_t offset, std::uint64_t allocation_size)
   {
-    sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_UNRECOGNIZED_COMMAND, "Command not implemented");
+    // Resuming an upload modifies an existing file. Thus, we check the
+    // permissions the same way as for APPE.
+    const std::string local_path = toLocalPath(param);
+    auto existing_file_filestatus = Filesystem::FileStatus(local_path);
+
+    if (existing_file_filestatus.isOk())
+    {
+      // The file does exist => we need Append Permissions
+      if (static_cast<int>(logged_in_user_->permissions_ & Permission::FileAppend) == 0)
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+        return;
+      }
+
+      // Return error message for anything that is not a file
+      if(existing_file_filestatus.type() != Filesystem::FileType::RegularFile)
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Pathname is not a file");
+        return;
+      }
+    }
+    else
+    {
+      // The file does not exist => we need Write Permissions
+      if (static_cast<int>(logged_in_user_->permissions_ & Permission::FileWrite) == 0)
+      {
+        sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+        return;
+      }
+    }
+
+    if (!data_acceptor_.is_open())
+    {
+      sendFtpMessage(FtpReplyCode::ERROR_OPENING_DATA_CONNECTION, "Error opening data connection");
+      return;
+    }
+
+    // We don't fill gaps, so the upload can only be resumed within the data that already exists
+    const std::uint64_t existing_file_size = (existing_file_filestatus.isOk() ? static_cast<std::uint64_t>(existing_file_filestatus.fileSize()) : 0);
+    if (offset > existing_file_size)
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INVALID_REST_PARAMETER, "Restart offset exceeds the file size");
+      return;
+    }
+
+    server_context_.file_cache->invalidate(local_path);
+    server_context_.listing_cache->invalidate(local_path);
+
+    const std::ios::openmode open_mode = (data_type_binary_ ? std::ios::binary : std::ios::openmode{});
+    const std::shared_ptr<WriteableFile> file = std::make_shared<WriteableFile>(local_path, open_mode, offset);
+
+    if (!file->good())
+    {
+#ifdef _WIN32
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error opening file for transfer: " + GetLastErrorStr());
+#else
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error opening file for transfer");
+#endif // _WIN32
+      return;
+    }
+
+    if (!preallocateUpload(file, allocation_size))
+      return;
+
+    sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Receiving file");
+    receiveFile(file, allocation_size);
   }
 
-  void FtpSession::handleFtpCommandREST(const std::string& /*param*/)
+  std::shared_ptr<WriteableFile> FtpSession::createUploadFile(const std::string& local_path, std::ios::openmode open_mode)
   {
-    sendFtpMessage(FtpReplyCode::COMMAND_NOT_IMPLEMENTED, "Command not implemented");
+    if (!server_context_.settings.atomic_uploads)
+      return std::make_shared<WriteableFile>(local_path, open_mode);
+
+    // The data is written to a hidden file in the same directory, as only a
+    // rename within the same file system replaces the target atomically.
+#ifdef _WIN32
+    const std::size_t name_start = local_path.find_last_of("/\\") + 1;
+#else
+    const std::size_t name_start = local_path.find_last_of('/') + 1;
+#endif // _WIN32
+
+    std::ostringstream temporary_path;
+    temporary_path << local_path.substr(0, name_start)
+                   << '.' << local_path.substr(name_start) << '.'
+                   << std::hex
+                   << std::setw(sizeof(random_distribution_inttype) * 2)
+                   << std::setfill('0')
+                   << random_distribution_(random_generator_)
+                   << ".part";
+
+    auto file = std::make_shared<WriteableFile>(temporary_path.str(), open_mode);
+    if (file->good())
+      file->setCommitTarget(local_path);
+    return file;
+  }
+
+  bool FtpSession::preallocateUpload(const std::shared_ptr<WriteableFile>& file, std::uint64_t allocation_size)
+  {
+    // Allocating the announced size at once keeps the file from being
+    // fragmented and lets us refuse the upload before any data is sent.
+    if ((allocation_size == 0) || file->preallocate(allocation_size))
+      return true;
+
+    file->close();
+    sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN_INSUFFICIENT_STORAGE_SPACE, "Insufficient storage space");
+    return false;
+  }
+
+  void FtpSession::handleFtpCommandALLO(const std::string& param)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    // The parameter is "<size> [R <record size>]". Records are not supported
+    // (only the file structure is), so the record size is ignored.
+    const std::string size = param.substr(0, param.find(' '));
+    if (size.empty() || (size.size() > 19) || !std::all_of(size.begin(), size.end(), [](char c) { return (c >= '0') && (c <= '9'); }))
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid allocation size");
+      return;
+    }
+
+    allocation_size_ = std::stoull(size);
+    sendFtpMessage(FtpReplyCode::COMMAND_OK, "Allocating " + size + " bytes for the next upload");
+  }
+
+  void FtpSession::handleFtpCommandREST(const std::string& param)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    // Only stream mode is supported, so the marker is a plain byte offset
+    if (param.empty() || (param.size() > 19) || !std::all_of(param.begin(), param.end(), [](char c) { return (c >= '0') && (c <= '9'); }))
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Invalid restart marker");
+      return;
+    }
+
+    restart_offset_ = std::stoull(param);
+    sendFtpMessage(FtpReplyCode::FILE_ACTION_NEEDS_FURTHER_INFO, "Restarting at " + param + ". Send STOR or RETR to initiate transfer");
   }
 
   void FtpSession::handleFtpCommandRNFR(const std::string& param)
@@ -871,6 +1111,15 @@ namespace fineftp
         return;
       }
 
+      // Files below a renamed directory would still be cached under their old
+      // paths (and keep Windows from renaming the directory at all)
+      if (Filesystem::FileStatus(local_from_path).type() == Filesystem::FileType::Dir)
+        server_context_.file_cache->clear();
+      else
+        server_context_.file_cache->invalidate(local_from_path);
+      server_context_.listing_cache->invalidate(local_from_path);
+      server_context_.listing_cache->invalidate(local_to_path);
+
 #ifdef _WIN32
 
       if (MoveFileW(StrConvert::Utf8ToWide(local_from_path).c_str(), StrConvert::Utf8ToWide(local_to_path).c_str()) != 0)
@@ -938,6 +1187,9 @@ namespace fineftp
       }
       else
       {
+        server_context_.file_cache->invalidate(local_path);
+        server_context_.listing_cache->invalidate(local_path);
+
 #ifdef _WIN32
         if (DeleteFileW(StrConvert::Utf8ToWide(local_path).c_str()) != 0)
         {
@@ -980,6 +1232,9 @@ namespace fineftp
 
     const std::string local_path = toLocalPath(param);
 
+    // Only empty directories can be removed, so there are no cached files below it
+    server_context_.listing_cache->invalidate(local_path);
+
 #ifdef _WIN32
     if (RemoveDirectoryW(StrConvert::Utf8ToWide(local_path).c_str()) != 0)
     {
@@ -1027,6 +1282,8 @@ namespace fineftp
 
     auto local_path = toLocalPath(param);
 
+    server_context_.listing_cache->invalidate(local_path);
+
 #ifdef _WIN32
     LPSECURITY_ATTRIBUTES security_attributes = nullptr; // => Default security attributes
     if (CreateDirectoryW(StrConvert::Utf8ToWide(local_path).c_str(), security_attributes) != 0)
@@ -1128,16 +1385,22 @@ namespace fineftp
     }
 
     const std::string local_path = toLocalPath(path2dst);
+
+    std::uint64_t cache_generation = 0;
+    if (sendCachedDirectoryListing(local_path, ListingFormat::List, "Sending directory listing", cache_generation))
+      return;
+
     auto dir_status = Filesystem::FileStatus(local_path);
 
     if (dir_status.isOk())
     {
       if (dir_status.type() == Filesystem::FileType::Dir)
       {
-        if (dir_status.canOpenDir())
+        std::unique_ptr<Filesystem::DirectoryReader> directory_reader(new Filesystem::DirectoryReader(local_path, error_));
+        if (directory_reader->isOk())
         {
           sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending directory listing");
-          sendDirectoryListing(Filesystem::dirContent(local_path, error_));
+          sendDirectoryListing(std::move(directory_reader), ListingFormat::List, local_path, cache_generation);
           return;
         }
         else
@@ -1176,16 +1439,22 @@ namespace fineftp
     }
 
     const std::string local_path = toLocalPath(param);
+
+    std::uint64_t cache_generation = 0;
+    if (sendCachedDirectoryListing(local_path, ListingFormat::NameList, "Sending name list", cache_generation))
+      return;
+
     auto dir_status = Filesystem::FileStatus(local_path);
 
     if (dir_status.isOk())
     {
       if (dir_status.type() == Filesystem::FileType::Dir)
       {
-        if (dir_status.canOpenDir())
+        std::unique_ptr<Filesystem::DirectoryReader> directory_reader(new Filesystem::DirectoryReader(local_path, error_));
+        if (directory_reader->isOk())
         {
           sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending name list");
-          sendNameList(Filesystem::dirContent(local_path, error_));
+          sendDirectoryListing(std::move(directory_reader), ListingFormat::NameList, local_path, cache_generation);
           return;
         }
         else
@@ -1225,9 +1494,28 @@ namespace fineftp
     sendFtpMessage(FtpReplyCode::NAME_SYSTEM_TYPE, "UNIX");
   }
 
-  void FtpSession::handleFtpCommandSTAT(const std::string& /*param*/)
+  void FtpSession::handleFtpCommandSTAT(const std::string& param)
   {
-    sendFtpMessage(FtpReplyCode::COMMAND_NOT_IMPLEMENTED, "Command not implemented");
+    // Listing files through the control connection is not supported
+    if (!param.empty())
+    {
+      sendFtpMessage(FtpReplyCode::COMMAND_NOT_IMPLEMENTED_FOR_PARAMETER, "Command not implemented for that parameter");
+      return;
+    }
+
+    std::stringstream ss;
+    ss << "211-Status of fineFTP server:\r\n";
+    if (logged_in_user_)
+      ss << " Logged in as " << username_for_login_ << "\r\n";
+    else
+      ss << " Not logged in\r\n";
+    ss << " TYPE: " << (data_type_binary_ ? "Image" : "ASCII") << "\r\n";
+    ss << " Receive buffer size: " << receive_buffer_size_ << " bytes\r\n";
+    ss << " Receive rate: " << receive_rate_ << " bytes/s\r\n";
+    ss << " Durable uploads: " << durable_uploads_ << "\r\n";
+    ss << "211 End of status\r\n";
+
+    sendRawFtpMessage(ss.str());
   }
 
   void FtpSession::handleFtpCommandHELP(const std::string& /*param*/)
@@ -1248,6 +1536,15 @@ namespace fineftp
     ss << " UTF8\r\n";
     ss << " SIZE\r\n";
     ss << " MDTM\r\n";
+    ss << " MLST ";
+    for (const auto& fact : supported_mlst_facts)
+    {
+      // Facts that are currently enabled are marked with an asterisk
+      const bool enabled = (std::find(mlst_facts_.begin(), mlst_facts_.end(), fact) != mlst_facts_.end());
+      ss << fact << (enabled ? "*;" : ";");
+    }
+    ss << "\r\n";
+    ss << " REST STREAM\r\n";
     ss << " LANG EN\r\n";
     ss << "211 END\r\n";
 
@@ -1265,6 +1562,37 @@ namespace fineftp
       return;
     }
 
+    if ((param_upper == "MLST") || (param_upper.substr(0, 5) == "MLST "))
+    {
+      // OPTS MLST <fact>;<fact>;... selects the facts of MLSD and MLST
+      // listings. Unknown facts are ignored and an empty list disables all
+      // facts. The reply contains the facts that are now enabled.
+      const std::string requested_facts = (param_upper.size() > 5 ? param_upper.substr(5) : "");
+
+      std::vector<std::string> requested_facts_list;
+      std::stringstream requested_facts_stream(requested_facts);
+      std::string requested_fact;
+      while (std::getline(requested_facts_stream, requested_fact, ';'))
+      {
+        std::transform(requested_fact.begin(), requested_fact.end(), requested_fact.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+        requested_facts_list.push_back(requested_fact);
+      }
+
+      mlst_facts_.clear();
+      std::string enabled_facts;
+      for (const auto& fact : supported_mlst_facts)
+      {
+        if (std::find(requested_facts_list.begin(), requested_facts_list.end(), fact) != requested_facts_list.end())
+        {
+          mlst_facts_.push_back(fact);
+          enabled_facts += fact + ";";
+        }
+      }
+
+      sendFtpMessage(FtpReplyCode::COMMAND_OK, enabled_facts.empty() ? "MLST OPTS" : "MLST OPTS " + enabled_facts);
+      return;
+    }
+
     sendFtpMessage(FtpReplyCode::COMMAND_NOT_IMPLEMENTED_FOR_PARAMETER, "Unrecognized parameter");
   }
 
@@ -1300,6 +1628,86 @@ namespace fineftp
     sendFtpMessage(FtpReplyCode::FILE_STATUS, file_status.generalizedTimeString());
   }
 
+  void FtpSession::handleFtpCommandMLSD(const std::string& param)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN,    "Not logged in");
+      return;
+    }
+
+    // RFC 959 does not allow ACTION_NOT_TAKEN (-> permanent error), so we return a temporary error (FILE_ACTION_NOT_TAKEN).
+    if (static_cast<int>(logged_in_user_->permissions_ & Permission::DirList) == 0)
+    {
+      sendFtpMessage(FtpReplyCode::FILE_ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    const std::string local_path = toLocalPath(param);
+
+    std::uint64_t cache_generation = 0;
+    if (sendCachedDirectoryListing(local_path, ListingFormat::MachineListing, "Sending machine listing", cache_generation))
+      return;
+
+    auto dir_status = Filesystem::FileStatus(local_path);
+
+    if (!dir_status.isOk())
+    {
+      sendFtpMessage(FtpReplyCode::FILE_ACTION_NOT_TAKEN, "Path does not exist");
+      return;
+    }
+
+    // RFC 3659 demands a permanent error when the path is not a directory
+    if (dir_status.type() != Filesystem::FileType::Dir)
+    {
+      sendFtpMessage(FtpReplyCode::SYNTAX_ERROR_PARAMETERS, "Path is not a directory");
+      return;
+    }
+
+    std::unique_ptr<Filesystem::DirectoryReader> directory_reader(new Filesystem::DirectoryReader(local_path, error_));
+    if (!directory_reader->isOk())
+    {
+      sendFtpMessage(FtpReplyCode::FILE_ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, "Sending machine listing");
+    sendDirectoryListing(std::move(directory_reader), ListingFormat::MachineListing, local_path, cache_generation);
+  }
+
+  void FtpSession::handleFtpCommandMLST(const std::string& param)
+  {
+    if (!logged_in_user_)
+    {
+      sendFtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
+      return;
+    }
+
+    if (static_cast<int>(logged_in_user_->permissions_ & (Permission::FileRead | Permission::DirList)) == 0)
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Permission denied");
+      return;
+    }
+
+    const std::string local_path = toLocalPath(param);
+    auto file_status = Filesystem::FileStatus(local_path);
+
+    if (!file_status.isOk())
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_NOT_TAKEN, "Path does not exist");
+      return;
+    }
+
+    // The listing is sent over the control connection. The entry line starts
+    // with a space and contains the absolute path of the file.
+    std::stringstream ss;
+    ss << "250-Listing " << (param.empty() ? ftp_working_directory_ : param) << "\r\n";
+    ss << " " << machineListingFacts(file_status, "", mlst_facts_, logged_in_user_->permissions_) << " " << toAbsoluteFtpPath(param) << "\r\n";
+    ss << "250 End\r\n";
+
+    sendRawFtpMessage(ss.str());
+  }
+
   ////////////////////////////////////////////////////////
   // FTP data-socket send
   ////////////////////////////////////////////////////////
@@ -1390,114 +1798,544 @@ namespace fineftp
     data_socket->close(ec);
   }
 
-  void FtpSession::sendDirectoryListing(const std::map<std::string, Filesystem::FileStatus>& directory_content)
+  struct FtpSession::DirectoryListing
   {
-    acceptDataConnection([directory_content, me = shared_from_this()](const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
-                         {
-                                  // Create a Unix-like file list
-                                  std::stringstream stream; // NOLINT(misc-const-correctness) Reason: False detection, this cannot be made const
-                                  for (const auto& entry : directory_content)
-                                  {
-                                    const std::string& filename(entry.first);
-                                    const fineftp::Filesystem::FileStatus& file_status(entry.second);
-
-                                    stream << ((file_status.type() == fineftp::Filesystem::FileType::Dir) ? 'd' : '-') << file_status.permissionString() << "   1 ";
-                                    stream << std::setw(10) << file_status.ownerString() << " " << std::setw(10) << file_status.groupString() << " ";
-                                    stream << std::setw(10) << file_status.fileSize() << " ";
-                                    stream << file_status.timeString() << " ";
-                                    stream << filename;
-                                    stream << "\r\n";
-                                  }
+    DirectoryListing(std::unique_ptr<Filesystem::DirectoryReader> directory_reader, ListingFormat format_, const std::vector<std::string>& mlst_facts_, Permission permissions_)
+      : reader      (std::move(directory_reader))
+      , format      (format_)
+      , mlst_facts  (mlst_facts_)
+      , permissions (permissions_)
+      , needs_status(false)
+    {
+      // Apart from the type (which is usually known from the directory entry)
+      // the facts type and perm don't need the status of the entry
+      const auto fact_needs_status = [](const std::string& fact) { return (fact == "size") || (fact == "modify") || (fact == "unique"); };
+      needs_status = (format == ListingFormat::List)
+                  || ((format == ListingFormat::MachineListing) && std::any_of(mlst_facts.begin(), mlst_facts.end(), fact_needs_status));
+    }
+
+    /** Creates the line of the entry with the given name and type, including the line ending */
+    std::string formatEntry(const std::string& name, Filesystem::FileType type) const
+    {
+      // Name lists never need the status of the entries
+      if (format == ListingFormat::NameList)
+        return name + "\r\n";
 
-                                  // Copy the file list into a raw char vector
-                                  const std::string dir_listing_string = stream.str();
-                                  const std::shared_ptr<std::vector<char>> dir_listing_rawdata = std::make_shared<std::vector<char>>();
-                                  dir_listing_rawdata->reserve(dir_listing_string.size());
-                                  std::copy(dir_listing_string.begin(), dir_listing_string.end(), std::back_inserter(*dir_listing_rawdata));
+      const Filesystem::FileStatus file_status = (needs_status || (type == Filesystem::FileType::Unknown)) ? reader->status(name) : Filesystem::FileStatus(name, type);
+      std::stringstream stream; // NOLINT(misc-const-correctness) Reason: False detection, this cannot be made const
 
-                                  // Send the string out
-                                  me->addDataToBufferAndSend(dir_listing_rawdata, data_socket);
-                                  me->addDataToBufferAndSend(std::shared_ptr<std::vector<char>>(), data_socket);// Nullpointer indicates end of transmission
-                         });
+      if (format == ListingFormat::List)
+      {
+        // Create a Unix-like file list
+        stream << ((file_status.type() == fineftp::Filesystem::FileType::Dir) ? 'd' : '-') << file_status.permissionString() << "   1 ";
+        stream << std::setw(10) << file_status.ownerString() << " " << std::setw(10) << file_status.groupString() << " ";
+        stream << std::setw(10) << file_status.fileSize() << " ";
+        stream << file_status.timeString() << " ";
+      }
+      else
+      {
+        std::string type_fact;
+        if (name == ".")
+          type_fact = "cdir";
+        else if (name == "..")
+          type_fact = "pdir";
+
+        stream << machineListingFacts(file_status, type_fact, mlst_facts, permissions) << " ";
+      }
+
+      stream << name << "\r\n";
+      return stream.str();
+    }
+
+    const std::unique_ptr<Filesystem::DirectoryReader> reader;
+    const ListingFormat                                format;
+
+    // All names are read and sorted before the first batch is formatted
+    bool                                                          names_read = false;
+    std::vector<std::pair<std::string, Filesystem::FileType>>     names;          ///< Names and types, sorted by name
+    std::size_t                                                   next_name = 0;  ///< Index of the first name of the next batch
+
+    // The session state is copied, as the listing is created on the disk threads
+    const std::vector<std::string>                     mlst_facts;
+    const Permission                                   permissions;
+
+    bool                                               needs_status;   ///< Whether the entries have to be stat'ed
+
+    // The listing is collected for the listing cache, as long as it fits
+    std::string                                        cache_path;
+    std::string                                        cache_variant;
+    std::uint64_t                                      cache_generation = 0;
+    std::shared_ptr<std::vector<char>>                 cache_data;     ///< nullptr, if the listing is not cached
+  };
+
+  struct FtpSession::DirectoryListingBatch
+  {
+    std::vector<std::pair<std::string, Filesystem::FileType>> entries;            ///< Names and types, sorted by name
+    std::vector<std::string>                                  lines;              ///< The formatted entries, in the same order as the entries
+    std::atomic<std::size_t>                                  remaining_parts{0}; ///< Parts of the batch that are still being formatted
+  };
+
+  std::string FtpSession::listingCacheVariant(ListingFormat format) const
+  {
+    switch (format)
+    {
+    case ListingFormat::List:
+      return "LIST";
+    case ListingFormat::NameList:
+      return "NLST";
+    default:
+      break;
+    }
+
+    // Machine listings differ by the selected facts and the permissions (perm fact)
+    std::string variant = "MLSD " + std::to_string(static_cast<int>(logged_in_user_->permissions_));
+    for (const auto& fact : mlst_facts_)
+      variant += " " + fact;
+    return variant;
   }
 
-  void FtpSession::sendNameList(const std::map<std::string, Filesystem::FileStatus>& directory_content)
+  bool FtpSession::sendCachedDirectoryListing(const std::string& local_path, ListingFormat format, const std::string& message, std::uint64_t& cache_generation)
   {
-    acceptDataConnection([directory_content, me = shared_from_this()](const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
-                         {
-                                  // Create a file list
-                                  std::stringstream stream; // NOLINT(misc-const-correctness) Reason: False detection, this cannot be made const
-                                  for (const auto& entry : directory_content)
-                                  {
-                                    stream << entry.first;
-                                    stream << "\r\n";
-                                  }
+    const std::shared_ptr<std::vector<char>> cached_listing = server_context_.listing_cache->get(local_path, listingCacheVariant(format), cache_generation);
+    if (!cached_listing)
+      return false;
 
-                                  // Copy the file list into a raw char vector
-                                  const std::string dir_listing_string = stream.str();
-                                  const std::shared_ptr<std::vector<char>> dir_listing_rawdata = std::make_shared<std::vector<char>>();
-                                  dir_listing_rawdata->reserve(dir_listing_string.size());
-                                  std::copy(dir_listing_string.begin(), dir_listing_string.end(), std::back_inserter(*dir_listing_rawdata));
+    sendFtpMessage(FtpReplyCode::FILE_STATUS_OK_OPENING_DATA_CONNECTION, message);
+    acceptDataConnection([cached_listing, me = shared_from_this()](const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+                         {
+                           if (!cached_listing->empty())
+                             me->addDataToBufferAndSend(cached_listing, data_socket);
 
-                                  // Send the string out
-                                  me->addDataToBufferAndSend(dir_listing_rawdata, data_socket);
-                                  me->addDataToBufferAndSend(std::shared_ptr<std::vector<char>>(), data_socket);// Nullpointer indicates end of transmission
+                           // Nullpointer indicates end of transmission
+                           me->addDataToBufferAndSend(std::shared_ptr<std::vector<char>>(), data_socket);
                          });
+    return true;
   }
 
-  void FtpSession::sendFile(const std::shared_ptr<ReadableFile>& file)
+  void FtpSession::sendDirectoryListing(std::unique_ptr<Filesystem::DirectoryReader> directory_reader, ListingFormat format, const std::string& local_path, std::uint64_t cache_generation)
   {
-    acceptDataConnection([file, me = shared_from_this()](const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
-                         {
-                                  if (file->size() == 0U)
+    const auto listing = std::make_shared<DirectoryListing>(std::move(directory_reader), format, mlst_facts_, logged_in_user_->permissions_);
+
+    if (cache_generation != 0)
+    {
+      listing->cache_path       = local_path;
+      listing->cache_variant    = listingCacheVariant(format);
+      listing->cache_generation = cache_generation;
+      listing->cache_data       = std::make_shared<std::vector<char>>();
+    }
+
+    acceptDataConnection([listing, me = shared_from_this()](const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+                         {
+                           me->sendDirectoryListingBatch(listing, data_socket);
+                         });
+  }
+
+  void FtpSession::sendDirectoryListingBatch(const std::shared_ptr<DirectoryListing>& listing, const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+  {
+    // Reading the directory and the status of its entries blocks on the disk,
+    // so each batch is created on the directory listing threads. The next
+    // batch is only read once the previous one has been sent, so a listing
+    // never holds more than one batch.
+    asio::post(*server_context_.directory_listing_pool, [me = shared_from_this(), listing, data_socket]()
+            {
+              // The directory is read in the order of the file system. Reading
+              // the names (and the types from the directory entries) is cheap,
+              // so all of them are read and sorted up front. Only stat'ing and
+              // formatting the entries is done batch by batch.
+              if (!listing->names_read)
+              {
+                std::string          name;
+                Filesystem::FileType type = Filesystem::FileType::Unknown;
+                while (listing->reader->next(name, type))
+                {
+                  listing->names.emplace_back(std::move(name), type);
+                }
+                std::sort(listing->names.begin(), listing->names.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+                listing->names_read = true;
+              }
+
+              auto batch = std::make_shared<DirectoryListingBatch>();
+              const std::size_t batch_end = std::min(listing->next_name + listing_batch_size, listing->names.size());
+              batch->entries.assign(std::make_move_iterator(listing->names.begin() + static_cast<std::ptrdiff_t>(listing->next_name))
+                                  , std::make_move_iterator(listing->names.begin() + static_cast<std::ptrdiff_t>(batch_end)));
+              listing->next_name = batch_end;
+
+              if (batch->entries.empty())
+              {
+                if (listing->cache_data)
+                  me->server_context_.listing_cache->put(listing->cache_path, listing->cache_variant, listing->cache_generation, listing->cache_data);
+
+                // Nullpointer indicates end of transmission
+                me->addDataToBufferAndSend(std::shared_ptr<std::vector<char>>(), data_socket);
+                return;
+              }
+
+              batch->lines.resize(batch->entries.size());
+
+              // Stat'ing is bound by the latency of the storage, so the entries
+              // are split into parts that are stat'ed by multiple threads
+              std::size_t part_count = 1;
+              if (listing->needs_status)
+              {
+                part_count = std::max<std::size_t>(1, batch->entries.size() / listing_min_entries_per_thread);
+                part_count = std::min(part_count, me->server_context_.settings.directory_listing_thread_count);
+              }
+              batch->remaining_parts = part_count;
+
+              const std::size_t part_size = (batch->entries.size() + part_count - 1) / part_count;
+              for (std::size_t part = 1; part < part_count; part++)
+              {
+                const std::size_t begin = part * part_size;
+                const std::size_t end   = std::min(begin + part_size, batch->entries.size());
+                asio::post(*me->server_context_.directory_listing_pool, [me, listing, batch, begin, end, data_socket]()
+                        {
+                          me->formatDirectoryListingPart(listing, batch, begin, end, data_socket);
+                        });
+              }
+
+              // The first part is formatted by this thread
+              me->formatDirectoryListingPart(listing, batch, 0, std::min(part_size, batch->entries.size()), data_socket);
+            });
+  }
+
+  void FtpSession::formatDirectoryListingPart(const std::shared_ptr<DirectoryListing>& listing, const std::shared_ptr<DirectoryListingBatch>& batch, std::size_t begin, std::size_t end, const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+  {
+    for (std::size_t i = begin; i < end; i++)
+    {
+      batch->lines[i] = listing->formatEntry(batch->entries[i].first, batch->entries[i].second);
+    }
+
+    // The thread that finishes the last part sends the batch
+    if (--batch->remaining_parts == 0)
+    {
+      writeDirectoryListingBatch(listing, batch, data_socket);
+    }
+  }
+
+  void FtpSession::writeDirectoryListingBatch(const std::shared_ptr<DirectoryListing>& listing, const std::shared_ptr<DirectoryListingBatch>& batch, const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+  {
+    std::size_t batch_size = 0;
+    for (const auto& line : batch->lines)
+      batch_size += line.size();
+
+    const std::shared_ptr<std::vector<char>> buffer = server_context_.receive_buffer_pool->acquire(batch_size);
+    buffer->clear();
+    for (const auto& line : batch->lines)
+      buffer->insert(buffer->end(), line.begin(), line.end());
+
+    if (listing->cache_data)
+    {
+      if (listing->cache_data->size() + buffer->size() <= server_context_.listing_cache->maxListingSize())
+        listing->cache_data->insert(listing->cache_data->end(), buffer->begin(), buffer->end());
+      else
+        listing->cache_data.reset(); // Too large to be cached
+    }
+
+    asio::post(data_socket_strand_, [me = shared_from_this(), listing, buffer, data_socket]()
+            {
+              me->asyncWriteLimited(data_socket
+                                  , asio::buffer(*buffer)
+                                  , [me, listing, buffer, data_socket](asio::error_code ec)
                                   {
-                                    me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
-                                  }
-                                  else if (file->data() == nullptr)
+                                    if (ec)
+                                    {
+                                      me->error_ << "Data write error: " << ec.message() << std::endl;
+                                      return;
+                                    }
+
+                                    me->sendDirectoryListingBatch(listing, data_socket);
+                                  });
+            });
+  }
+
+  void FtpSession::sendFile(const std::shared_ptr<ReadableFile>& file, std::size_t offset)
+  {
+    acceptDataConnection([file, offset, me = shared_from_this()](const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+                         {
+                                  // The bytes before the offset (e.g. from a REST command) are never touched
+                                  if (file->size() <= offset)
                                   {
-                                    // Error that should never happen. If it does, it's a bug in the server.
-                                    // Usually, if the data is null, the file size should be 0.
-                                    me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: File data is null");
+                                    me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
                                   }
                                   else
                                   {
-                                    // Send the file
-                                    asio::async_write(*data_socket
-                                                    , asio::buffer(file->data(), file->size())
-                                                    , [me, file, data_socket](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
-                                                      {
-                                                        if (ec)
-                                                        {
-                                                          me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
-                                                        }
-                                                        else
-                                                        {
-                                                          me->closeDataSocket(data_socket);
-
-                                                          // Ugly work-around:
-                                                          // An FTP client implementation has been observed to close the data connection
-                                                          // as soon as it receives the 226 status code - even though it hasn't received
-                                                          // all data, yet. To improve interoperability with such buggy clients, sending
-                                                          // of the 226 status code can be delayed a bit. The delay is defined through a
-                                                          // preprocessor definition. If the delay is 0, no delay is introduced at all.
-                                                          #if (0 == DELAY_226_RESP_MS)
-                                                            me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
-                                                          #else
-                                                            me->timer_.expires_after(std::chrono::milliseconds{DELAY_226_RESP_MS});
-                                                            me->timer_.async_wait(me->data_socket_strand_.wrap([me](const asio::error_code& ec)
-                                                                                  {
-                                                                                    if (ec != asio::error::operation_aborted)
-                                                                                    {
-                                                                                      me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
-                                                                                    }
-                                                                                  }));
-                                                          #endif
-                                                        }
-                                                      });
+#if defined(__linux__)
+                                    me->sendFileZeroCopy(file, data_socket, offset);
+#else
+                                    me->sendFileMapped(file, data_socket, file->mapWindow(offset, me->server_context_.settings.file_window_size));
+#endif // __linux__
                                   }
                          });
   }
 
+  void FtpSession::sendFileMapped(const std::shared_ptr<ReadableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, const std::shared_ptr<FileWindow>& window)
+  {
+    if (!window)
+    {
+      sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: Unable to map file");
+      return;
+    }
+
+    // Sending pages that are not in the page cache would block this thread
+    // on page faults. Let the prefetcher read the window first.
+    const std::size_t resident_size = window->residentSize();
+    if (resident_size < window->size())
+    {
+      loadFileWindow(file, window, window->offset() + resident_size, [me = shared_from_this(), file, data_socket, window]()
+                                                                    {
+                                                                      me->sendFileWindow(file, data_socket, window);
+                                                                    });
+      return;
+    }
+
+    sendFileWindow(file, data_socket, window);
+  }
+
+  void FtpSession::loadFileWindow(const std::shared_ptr<ReadableFile>& file, const std::shared_ptr<FileWindow>& window, std::size_t offset, const std::function<void()>& loaded_handler)
+  {
+    // Load all chunks of the window that are not resident, one after another
+    const std::size_t window_end = window->offset() + window->size();
+    server_context_.file_prefetcher->load(file, offset, [me = shared_from_this(), file, window, offset, window_end, loaded_handler]()
+                                                       {
+                                                         asio::post(me->data_socket_strand_, [me, file, window, offset, window_end, loaded_handler]()
+                                                                    {
+                                                                      const std::size_t next_offset = offset - (offset % me->server_context_.settings.file_prefetch_size) + me->server_context_.settings.file_prefetch_size;
+                                                                      if (next_offset < window_end)
+                                                                        me->loadFileWindow(file, window, next_offset, loaded_handler);
+                                                                      else
+                                                                        loaded_handler();
+                                                                    });
+                                                       });
+  }
+
+  void FtpSession::sendFileWindow(const std::shared_ptr<ReadableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, const std::shared_ptr<FileWindow>& window)
+  {
+    // Map the next window before sending the current one, so the operating
+    // system can read it ahead while the current one is being sent.
+    std::shared_ptr<FileWindow> next_window;
+    const std::size_t next_offset = window->offset() + window->size();
+    if (next_offset < file->size())
+    {
+      next_window = file->mapWindow(next_offset, server_context_.settings.file_window_size);
+      if (!next_window)
+      {
+        sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: Unable to map file");
+        return;
+      }
+    }
+
+    // Send the window. It is released (and unmapped) as soon as it has been sent.
+    asyncWriteLimited(data_socket
+                    , asio::buffer(window->data(), window->size())
+                    , [me = shared_from_this(), file, data_socket, window, next_window](asio::error_code ec)
+                      {
+                        if (ec)
+                        {
+                          me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
+                        }
+                        else if (next_window)
+                        {
+                          me->sendFileMapped(file, data_socket, next_window);
+                        }
+                        else
+                        {
+                          me->endFileSending(data_socket);
+                        }
+                      });
+  }
+
+#ifdef __linux__
+  void FtpSession::sendFileZeroCopy(const std::shared_ptr<ReadableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, std::size_t offset)
+  {
+    // sendfile() lets the kernel copy the file from the page cache directly
+    // to the socket. The socket is used in non-blocking mode, so sendfile()
+    // returns as soon as the socket buffer is full. In that case we let asio
+    // notify us when the socket is writable again.
+    if (!data_socket->non_blocking())
+    {
+      asio::error_code ec;
+      data_socket->non_blocking(true, ec);
+      if (ec)
+      {
+        sendFileMapped(file, data_socket, file->mapWindow(offset, server_context_.settings.file_window_size));
+        return;
+      }
+    }
+
+    // Pause, if the bandwidth limit has been exceeded
+    const auto delay = bandwidthDelay();
+    if (delay > std::chrono::steady_clock::duration::zero())
+    {
+      timer_.expires_after(delay);
+      timer_.async_wait(data_socket_strand_.wrap([me = shared_from_this(), file, data_socket, offset](asio::error_code ec)
+                        {
+                          if (ec)
+                          {
+                            me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
+                            return;
+                          }
+                          me->sendFileZeroCopy(file, data_socket, offset);
+                        }));
+      return;
+    }
+
+    // Wait for our turn
+    server_context_.transfer_scheduler->request(transfer_flow_, transfer_weight_
+                                              , [me = shared_from_this(), file, data_socket, offset](std::size_t quantum)
+                                                {
+                                                  asio::post(me->data_socket_strand_, [me, file, data_socket, offset, quantum]()
+                                                             {
+                                                               me->sendFileZeroCopyQuantum(file, data_socket, offset, quantum);
+                                                             });
+                                                });
+  }
+
+  void FtpSession::sendFileZeroCopyQuantum(const std::shared_ptr<ReadableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, std::size_t offset, std::size_t quantum)
+  {
+    const std::size_t window_size  = server_context_.settings.file_window_size;
+    const std::size_t start_offset = offset;
+    std::size_t       quantum_end  = (std::min)(file->size(), offset + bandwidthChunkSize(quantum));
+
+    // Only send what is in the page cache, so sendfile() doesn't block this
+    // thread on disk reads. The rest is loaded by the prefetcher.
+    const std::size_t resident_size = file->residentSize(offset, quantum_end - offset);
+    if (resident_size == 0)
+    {
+      server_context_.transfer_scheduler->release(transfer_flow_, 0);
+      server_context_.file_prefetcher->load(file, offset, [me = shared_from_this(), file, data_socket, offset]()
+                                                          {
+                                                            asio::post(me->data_socket_strand_, [me, file, data_socket, offset]()
+                                                                       {
+                                                                         me->sendFileZeroCopy(file, data_socket, offset);
+                                                                       });
+                                                          });
+      return;
+    }
+    else if (offset + resident_size < quantum_end)
+    {
+      quantum_end = offset + resident_size;
+    }
+
+    // Load the next chunk while this one is being sent
+    if (quantum_end < file->size())
+    {
+      const std::size_t prefetch_size = server_context_.settings.file_prefetch_size;
+      if (file->residentSize(quantum_end, prefetch_size) < (std::min)(prefetch_size, file->size() - quantum_end))
+      {
+        server_context_.file_prefetcher->load(file, quantum_end, nullptr);
+      }
+    }
+
+    bool would_block = false;
+    int  error       = 0;
+
+    while (offset < quantum_end)
+    {
+      // The file is sent window by window. Whenever we enter a new window, the
+      // kernel is advised to read the next one ahead.
+      if ((offset % window_size) == 0)
+      {
+        file->prefetch(offset + window_size, window_size);
+      }
+      const std::size_t window_end = (std::min)(quantum_end, offset - (offset % window_size) + window_size);
+
+      off_t file_offset = static_cast<off_t>(offset);
+      const ssize_t bytes_sent = ::sendfile(data_socket->native_handle(), file->handle(), &file_offset, window_end - offset);
+
+      if (bytes_sent > 0)
+      {
+        offset += static_cast<std::size_t>(bytes_sent);
+      }
+      else if ((bytes_sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      {
+        would_block = true;
+        break;
+      }
+      else if ((bytes_sent < 0) && (errno == EINTR))
+      {
+        continue;
+      }
+      else
+      {
+        error = ((bytes_sent == 0) ? ENODATA : errno);
+        break;
+      }
+    }
+
+    consumeBandwidth(offset - start_offset);
+    server_context_.transfer_scheduler->release(transfer_flow_, offset - start_offset);
+
+    if ((offset > start_offset) && isColdStreaming(*file))
+    {
+      dropSentFromCache(*file, start_offset, offset);
+    }
+
+    if ((error == EINVAL) || (error == ENOSYS))
+    {
+      // The file cannot be used with sendfile (e.g. because the filesystem
+      // does not support it). Fall back to sending the mapped file.
+      asio::error_code ec;
+      data_socket->non_blocking(false, ec);
+      sendFileMapped(file, data_socket, file->mapWindow(offset, server_context_.settings.file_window_size));
+    }
+    else if (error == ENODATA)
+    {
+      // The file has been truncated while we were sending it
+      sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: Unexpected end of file");
+    }
+    else if (error != 0)
+    {
+      sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + std::string(std::strerror(error)));
+    }
+    else if (offset >= file->size())
+    {
+      endFileSending(data_socket);
+    }
+    else if (would_block)
+    {
+      // The socket buffer is full. Ask for the next quantum when the socket is writable again.
+      data_socket->async_wait(asio::ip::tcp::socket::wait_write
+                            , data_socket_strand_.wrap([me = shared_from_this(), file, data_socket, offset](asio::error_code ec)
+                              {
+                                if (ec)
+                                {
+                                  me->sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + ec.message());
+                                  return;
+                                }
+                                me->sendFileZeroCopy(file, data_socket, offset);
+                              }));
+    }
+    else
+    {
+      sendFileZeroCopy(file, data_socket, offset);
+    }
+  }
+#endif // __linux__
+
+  void FtpSession::endFileSending(const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+  {
+    closeDataSocket(data_socket);
+
+    // Ugly work-around:
+    // An FTP client implementation has been observed to close the data connection
+    // as soon as it receives the 226 status code - even though it hasn't received
+    // all data, yet. To improve interoperability with such buggy clients, sending
+    // of the 226 status code can be delayed a bit. The delay is defined through a
+    // preprocessor definition. If the delay is 0, no delay is introduced at all.
+    #if (0 == DELAY_226_RESP_MS)
+      sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+    #else
+      timer_.expires_after(std::chrono::milliseconds{DELAY_226_RESP_MS});
+      timer_.async_wait(data_socket_strand_.wrap([me = shared_from_this()](const asio::error_code& ec)
+                        {
+                          if (ec != asio::error::operation_aborted)
+                          {
+                            me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+                          }
+                        }));
+    #endif
+  }
+
   void FtpSession::addDataToBufferAndSend(const std::shared_ptr<std::vector<char>>& data, const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
   {
     asio::post(data_socket_strand_, [me = shared_from_this(), data, data_socket]()
@@ -1523,9 +2361,9 @@ namespace fineftp
         if (data)
         {
           // Send out the buffer
-          asio::async_write(*data_socket
-                            , asio::buffer(*data)
-                            , me->data_socket_strand_.wrap([me, data, data_socket](asio::error_code ec, std::size_t /*bytes_to_transfer*/)
+          me->asyncWriteLimited(data_socket
+                              , asio::buffer(*data)
+                              , [me, data, data_socket](asio::error_code ec)
                               {
                                 me->data_buffer_.pop_front();
 
@@ -1539,8 +2377,7 @@ namespace fineftp
                                 {
                                   me->writeDataToSocket(data_socket);
                                 }
-                              }
-                              ));
+                              });
         }
         else
         {
@@ -1554,61 +2391,724 @@ namespace fineftp
       });
   }
 
+  void FtpSession::asyncWriteLimited(const std::shared_ptr<asio::ip::tcp::socket>& data_socket, asio::const_buffer buffer, const std::function<void(asio::error_code)>& handler)
+  {
+    // The caller has to keep the buffer alive until the handler is called.
+    if (!isBandwidthLimited())
+    {
+      asyncWriteScheduled(data_socket, buffer, handler);
+      return;
+    }
+
+    // Pause, if the bandwidth limit has been exceeded
+    const auto delay = bandwidthDelay();
+    if (delay > std::chrono::steady_clock::duration::zero())
+    {
+      timer_.expires_after(delay);
+      timer_.async_wait(data_socket_strand_.wrap([me = shared_from_this(), data_socket, buffer, handler](asio::error_code ec)
+                        {
+                          if (ec)
+                          {
+                            handler(ec);
+                            return;
+                          }
+                          me->asyncWriteLimited(data_socket, buffer, handler);
+                        }));
+      return;
+    }
+
+    // Send the next chunk
+    const std::size_t chunk_size = bandwidthChunkSize(buffer.size());
+    consumeBandwidth(chunk_size);
+
+    asyncWriteScheduled(data_socket
+                      , asio::buffer(buffer.data(), chunk_size)
+                      , [me = shared_from_this(), data_socket, buffer, chunk_size, handler](asio::error_code ec)
+                        {
+                          if (ec || (chunk_size == buffer.size()))
+                          {
+                            handler(ec);
+                            return;
+                          }
+                          me->asyncWriteLimited(data_socket, buffer + chunk_size, handler);
+                        });
+  }
+
+  void FtpSession::asyncWriteScheduled(const std::shared_ptr<asio::ip::tcp::socket>& data_socket, asio::const_buffer buffer, const std::function<void(asio::error_code)>& handler)
+  {
+    // Only ask for a quantum once the socket is writable, so a slow client
+    // doesn't occupy a quantum that other transfers could use.
+    data_socket->async_wait(asio::ip::tcp::socket::wait_write
+                          , data_socket_strand_.wrap([me = shared_from_this(), data_socket, buffer, handler](asio::error_code ec)
+                            {
+                              if (ec)
+                              {
+                                handler(ec);
+                                return;
+                              }
+
+                              me->server_context_.transfer_scheduler->request(me->transfer_flow_, me->transfer_weight_
+                                                                            , [me, data_socket, buffer, handler](std::size_t quantum)
+                                                                              {
+                                                                                asio::post(me->data_socket_strand_, [me, data_socket, buffer, handler, quantum]()
+                                                                                           {
+                                                                                             // Write as much of the quantum as the socket takes without blocking
+                                                                                             asio::error_code write_ec;
+                                                                                             if (!data_socket->non_blocking())
+                                                                                               data_socket->non_blocking(true, write_ec);
+
+                                                                                             const std::size_t to_write = (std::min)(quantum, buffer.size());
+                                                                                             std::size_t written = 0;
+                                                                                             while (!write_ec && (written < to_write))
+                                                                                             {
+                                                                                               written += data_socket->write_some(asio::buffer(buffer + written, to_write - written), write_ec);
+                                                                                             }
+                                                                                             me->server_context_.transfer_scheduler->release(me->transfer_flow_, written);
+
+                                                                                             if (write_ec == asio::error::would_block || write_ec == asio::error::try_again)
+                                                                                               write_ec = asio::error_code();
+
+                                                                                             if (write_ec || (written == buffer.size()))
+                                                                                               handler(write_ec);
+                                                                                             else
+                                                                                               me->asyncWriteScheduled(data_socket, buffer + written, handler);
+                                                                                           });
+                                                                              });
+                            }));
+  }
+
+  void FtpSession::asyncReadScheduled(const std::shared_ptr<asio::ip::tcp::socket>& data_socket, asio::mutable_buffer buffer, const std::function<void(asio::error_code, std::size_t)>& handler)
+  {
+    // Only ask for a quantum once there is data to read, so a slow client
+    // doesn't occupy a quantum that other transfers could use.
+    data_socket->async_wait(asio::ip::tcp::socket::wait_read
+                          , data_socket_strand_.wrap([me = shared_from_this(), data_socket, buffer, handler](asio::error_code ec)
+                            {
+                              if (ec)
+                              {
+                                handler(ec, 0);
+                                return;
+                              }
+
+                              me->server_context_.transfer_scheduler->request(me->transfer_flow_, me->transfer_weight_
+                                                                            , [me, data_socket, buffer, handler](std::size_t quantum)
+                                                                              {
+                                                                                asio::post(me->data_socket_strand_, [me, data_socket, buffer, handler, quantum]()
+                                                                                           {
+                                                                                             // Complete with what a single read returns. Whether
+                                                                                             // that fills the buffer tells the caller if there is
+                                                                                             // more data waiting than the buffer can take.
+                                                                                             asio::error_code read_ec;
+                                                                                             if (!data_socket->non_blocking())
+                                                                                               data_socket->non_blocking(true, read_ec);
+
+                                                                                             std::size_t length = 0;
+                                                                                             if (!read_ec)
+                                                                                               length = data_socket->read_some(asio::buffer(buffer, quantum), read_ec);
+                                                                                             me->server_context_.transfer_scheduler->release(me->transfer_flow_, length);
+
+                                                                                             if (read_ec == asio::error::would_block || read_ec == asio::error::try_again)
+                                                                                               me->asyncReadScheduled(data_socket, buffer, handler);
+                                                                                             else
+                                                                                               handler(read_ec, length);
+                                                                                           });
+                                                                              });
+                            }));
+  }
+
   ////////////////////////////////////////////////////////
   // FTP data-socket receive
   ////////////////////////////////////////////////////////
 
-  void FtpSession::receiveFile(const std::shared_ptr<WriteableFile>& file)
+#ifdef __linux__
+  struct FtpSession::SplicePipe
   {
+    SplicePipe()
+    {
+      std::array<int, 2> fds{-1, -1};
+      if (::pipe2(fds.data(), O_CLOEXEC | O_NONBLOCK) != 0)
+        return;
+
+      read_end  = fds[0];
+      write_end = fds[1];
+
+      // A larger pipe lets us move more data per system call. If we are not
+      // allowed to grow it, we just use the default size.
+      const int pipe_size = ::fcntl(write_end, F_SETPIPE_SZ, 1024 * 1024);
+      capacity = static_cast<std::size_t>(pipe_size > 0 ? pipe_size : ::fcntl(write_end, F_GETPIPE_SZ));
+    }
+
+    // Copy / Move disabled
+    SplicePipe(const SplicePipe&)            = delete;
+    SplicePipe& operator=(const SplicePipe&) = delete;
+    SplicePipe(SplicePipe&&)                 = delete;
+    SplicePipe& operator=(SplicePipe&&)      = delete;
+
+    ~SplicePipe()
+    {
+      if (read_end != -1)
+        ::close(read_end);
+      if (write_end != -1)
+        ::close(write_end);
+    }
+
+    bool isOpen() const { return (read_end != -1) && (capacity > 0); }
+
+    /** Moves size bytes from the pipe to the file at the given offset. Returns 0 or an errno value. */
+    int moveToFile(int file_fd, std::uint64_t offset, std::size_t size) const
+    {
+      auto file_offset = static_cast<loff_t>(offset);
+      while (size > 0)
+      {
+        const ssize_t bytes_moved = ::splice(read_end, nullptr, file_fd, &file_offset, size, SPLICE_F_MOVE);
+        if (bytes_moved > 0)
+          size -= static_cast<std::size_t>(bytes_moved);
+        else if ((bytes_moved < 0) && (errno == EINTR))
+          continue;
+        else if ((bytes_moved < 0) && (errno == EINVAL))
+          return copyToFile(file_fd, file_offset, size);
+        else
+          return ((bytes_moved == 0) ? EIO : errno);
+      }
+      return 0;
+    }
+
+    /** Fallback for file systems that cannot be spliced to */
+    int copyToFile(int file_fd, loff_t offset, std::size_t size) const
+    {
+      std::array<char, 64 * 1024> buffer{};
+      while (size > 0)
+      {
+        const ssize_t bytes_read = ::read(read_end, buffer.data(), (std::min)(size, buffer.size()));
+        if ((bytes_read < 0) && (errno == EINTR))
+          continue;
+        else if (bytes_read <= 0)
+          return ((bytes_read == 0) ? EIO : errno);
+
+        std::size_t written = 0;
+        while (written < static_cast<std::size_t>(bytes_read))
+        {
+          const ssize_t bytes_written = ::pwrite(file_fd, buffer.data() + written, static_cast<std::size_t>(bytes_read) - written, offset);
+          if ((bytes_written < 0) && (errno == EINTR))
+            continue;
+          else if (bytes_written < 0)
+            return errno;
+
+          written += static_cast<std::size_t>(bytes_written);
+          offset  += bytes_written;
+        }
+        size -= static_cast<std::size_t>(bytes_read);
+      }
+      return 0;
+    }
+
+    int         read_end  = -1;
+    int         write_end = -1;
+    std::size_t capacity  = 0;
+  };
+#endif // __linux__
+
+  void FtpSession::receiveFile(const std::shared_ptr<WriteableFile>& file, std::uint64_t size_hint)
+  {
+    // Start with reads that fit the announced size (see ALLO), so small
+    // uploads don't need large buffers. The read size is adapted to the
+    // receive rate later on.
+    const ServerSettings& settings = server_context_.settings;
+    receive_buffer_size_ = static_cast<std::size_t>((std::max)(static_cast<std::uint64_t>(settings.min_receive_buffer_size)
+                                                             , (std::min)(static_cast<std::uint64_t>(settings.max_receive_buffer_size), size_hint)));
+    receive_rate_        = 0;
+
     acceptDataConnection([file, me = shared_from_this()](const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
                          {
+#ifdef __linux__
+                                  if (me->canReceiveZeroCopy())
+                                  {
+                                    auto pipe = std::make_shared<SplicePipe>();
+                                    if (pipe->isOpen())
+                                    {
+                                      me->receiveFileZeroCopy(file, data_socket, pipe);
+                                      return;
+                                    }
+                                  }
+#endif // __linux__
                                   me->receiveDataFromSocketAndWriteToFile(file, data_socket);
                          });
   }
 
+#ifdef __linux__
+  bool FtpSession::canReceiveZeroCopy() const
+  {
+    // The data has to be stored as it is received and we must be able to
+    // count and limit it per read. Splicing doesn't let us do either.
+    return data_type_binary_ && !isBandwidthLimited();
+  }
+
+  void FtpSession::receiveFileZeroCopy(const std::shared_ptr<WriteableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, const std::shared_ptr<SplicePipe>& pipe)
+  {
+    // The read size is determined by the pipe here. We only keep track of
+    // the receive rate.
+    receive_buffer_size_ = pipe->capacity;
+    const auto wait_start = std::chrono::steady_clock::now();
+
+    // splice() lets the kernel move the received data from the socket to a
+    // pipe and from there to the file, without copying it to user space. The
+    // socket side is performed on the io threads. The file side may block on
+    // the disk and is therefore performed by the disk writer pool.
+    if (!data_socket->non_blocking())
+    {
+      asio::error_code ec;
+      data_socket->non_blocking(true, ec);
+      if (ec)
+      {
+        receiveDataFromSocketAndWriteToFile(file, data_socket);
+        return;
+      }
+    }
+
+    data_socket->async_wait(asio::ip::tcp::socket::wait_read
+                          , data_socket_strand_.wrap([me = shared_from_this(), file, data_socket, pipe, wait_start](asio::error_code ec)
+                            {
+                              if (ec)
+                              {
+                                me->endDataReceiving(file, data_socket, ec);
+                                return;
+                              }
+
+                              // Wait for our turn
+                              me->server_context_.transfer_scheduler->request(me->transfer_flow_, me->transfer_weight_
+                                                                            , [me, file, data_socket, pipe, wait_start](std::size_t quantum)
+                                                                              {
+                                                                                asio::post(me->data_socket_strand_, [me, file, data_socket, pipe, quantum, wait_start]()
+                                                                                           {
+                                                                                             me->receiveFileZeroCopyQuantum(file, data_socket, pipe, quantum, wait_start);
+                                                                                           });
+                                                                              });
+                            }));
+  }
+
+  void FtpSession::receiveFileZeroCopyQuantum(const std::shared_ptr<WriteableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, const std::shared_ptr<SplicePipe>& pipe, std::size_t quantum, std::chrono::steady_clock::time_point wait_start)
+  {
+    const std::size_t max_size  = (std::min)(quantum, pipe->capacity);
+    std::size_t       size      = 0;
+    bool              end       = false;
+    int               error     = 0;    // errno of a failed splice, 0 if the client has closed the connection
+
+    while (size < max_size)
+    {
+      const ssize_t bytes_moved = ::splice(data_socket->native_handle(), nullptr, pipe->write_end, nullptr, max_size - size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (bytes_moved > 0)
+      {
+        size += static_cast<std::size_t>(bytes_moved);
+      }
+      else if ((bytes_moved < 0) && (errno == EINTR))
+      {
+        continue;
+      }
+      else if ((bytes_moved < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+      {
+        break;
+      }
+      else
+      {
+        // Either the client has closed the connection (0 bytes), or the
+        // connection has failed. Only the former completes the upload.
+        end   = true;
+        error = ((bytes_moved < 0) ? errno : 0);
+        break;
+      }
+    }
+    server_context_.transfer_scheduler->release(transfer_flow_, size);
+
+    const asio::error_code receive_error = ((error == 0) ? asio::error_code(asio::error::eof) : asio::error_code(error, asio::error::get_system_category()));
+
+    if (size == 0)
+    {
+      if ((error == EINVAL) || (error == ENOSYS))
+      {
+        // The socket cannot be spliced from. Nothing has been received, so
+        // we can just continue the regular way.
+        receiveDataFromSocketAndWriteToFile(file, data_socket);
+      }
+      else if (end)
+      {
+        endDataReceiving(file, data_socket, receive_error);
+      }
+      else
+      {
+        receiveFileZeroCopy(file, data_socket, pipe);
+      }
+      return;
+    }
+
+    consumeBandwidth(size);
+    updateReceiveRate(size, std::chrono::steady_clock::now() - wait_start);
+
+    // Let the disk writer pool move the data from the pipe to the file
+    const std::uint64_t offset = file->reserve(size);
+    asio::post(*server_context_.disk_writer_pool, [me = shared_from_this(), file, data_socket, pipe, offset, size, end, receive_error]()
+                                                  {
+                                                    const int write_error = pipe->moveToFile(file->handle(), offset, size);
+
+                                                    asio::post(me->data_socket_strand_, [me, file, data_socket, pipe, end, receive_error, write_error]()
+                                                                                        {
+                                                                                          if (write_error != 0)
+                                                                                          {
+                                                                                            me->file_write_error_ = write_error;
+                                                                                            me->endDataReceiving(file, data_socket, (end ? receive_error : asio::error_code(asio::error::operation_aborted)));
+                                                                                          }
+                                                                                          else if (end)
+                                                                                          {
+                                                                                            me->endDataReceiving(file, data_socket, receive_error);
+                                                                                          }
+                                                                                          else
+                                                                                          {
+                                                                                            me->receiveFileZeroCopy(file, data_socket, pipe);
+                                                                                          }
+                                                                                        });
+                                                  });
+  }
+#endif // __linux__
+
   void FtpSession::receiveDataFromSocketAndWriteToFile(const std::shared_ptr<WriteableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
   {
-    const std::shared_ptr<std::vector<char>> buffer = std::make_shared<std::vector<char>>(1024 * 1024 * 1);
+    const std::size_t read_size = receive_buffer_size_;
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    // Receive into one of the registered buffers, if there is one left that is large enough
+    std::shared_ptr<std::vector<char>> buffer = (server_context_.io_uring ? server_context_.io_uring->acquireBuffer() : nullptr);
+    if (buffer && (buffer->capacity() >= read_size))
+    {
+      buffer->resize(read_size);
+    }
+    else
+    {
+      buffer = server_context_.receive_buffer_pool->acquire(read_size);
+    }
+#else
+    const std::shared_ptr<std::vector<char>> buffer = server_context_.receive_buffer_pool->acquire(read_size);
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+    if (isBandwidthLimited())
+    {
+      // Pause, if the bandwidth limit has been exceeded. As we don't read
+      // from the socket meanwhile, TCP flow control slows down the client.
+      const auto delay = bandwidthDelay();
+      if (delay > std::chrono::steady_clock::duration::zero())
+      {
+        timer_.expires_after(delay);
+        timer_.async_wait(data_socket_strand_.wrap([me = shared_from_this(), file, data_socket](asio::error_code ec)
+                          {
+                            if (ec)
+                            {
+                              // The wait has been cancelled (e.g. the session
+                              // is shutting down), so the upload is incomplete
+                              me->endDataReceiving(file, data_socket, ec);
+                              return;
+                            }
+                            me->receiveDataFromSocketAndWriteToFile(file, data_socket);
+                          }));
+        return;
+      }
+
+      buffer->resize(bandwidthChunkSize(buffer->size()));
+    }
       
-    asio::async_read(*data_socket
-                    , asio::buffer(*buffer)
-                    , asio::transfer_at_least(buffer->size())
-                    , data_socket_strand_.wrap([me = shared_from_this(), file, data_socket, buffer](asio::error_code ec, std::size_t length)
+    const auto read_start = std::chrono::steady_clock::now();
+    asyncReadScheduled(data_socket
+                     , asio::buffer(*buffer)
+                     , [me = shared_from_this(), file, data_socket, buffer, read_start](asio::error_code ec, std::size_t length)
                       {
+                        const bool buffer_filled = (length == buffer->size());
                         buffer->resize(length);
+                        me->consumeBandwidth(length);
+                        me->updateReceiveRate(length, std::chrono::steady_clock::now() - read_start);
+                        me->adaptReceiveBufferSize(length, buffer_filled);
                         if (ec)
                         {
                           if (length > 0)
                           {
                             me->writeDataToFile(buffer, file);
                           }
-                          me->endDataReceiving(file, data_socket);
+                          me->endDataReceiving(file, data_socket, ec);
                           return;
                         }
                         else if (length > 0)
                         {
                           me->writeDataToFile(buffer, file, [me, file, data_socket]() { me->receiveDataFromSocketAndWriteToFile(file, data_socket); });
                         }
-                      }));
+                      });
+  }
+
+
+  void FtpSession::updateReceiveRate(std::size_t bytes, std::chrono::steady_clock::duration elapsed)
+  {
+    const auto elapsed_ns = (std::max)(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::chrono::nanoseconds::rep(1000));
+    const auto sample     = static_cast<std::uint64_t>(static_cast<double>(bytes) * 1e9 / static_cast<double>(elapsed_ns));
+
+    // Smooth the samples, so a single slow or fast read doesn't change much
+    const std::uint64_t rate = receive_rate_;
+    receive_rate_ = ((rate == 0) ? sample : ((rate * 7 + sample) / 8));
   }
 
+  void FtpSession::adaptReceiveBufferSize(std::size_t length, bool buffer_filled)
+  {
+    // A read that fills the buffer leaves data in the socket that the next
+    // read picks up, so we grow the buffer. A read that only returns a small
+    // part of the buffer means the buffer mostly waits for data, so we
+    // shrink it, unless the receive rate says that the buffer will be needed
+    // within the target duration. The size is only doubled or halved per
+    // read to avoid jumping around. Reads are limited to the transfer
+    // quantum, so larger buffers would never be filled.
+    const ServerSettings& settings = server_context_.settings;
+    const std::size_t max_size    = (std::max)(settings.min_receive_buffer_size, (std::min)(settings.max_receive_buffer_size, settings.transfer_quantum_size * transfer_weight_));
+    const auto        target_size = static_cast<double>(receive_rate_) * std::chrono::duration<double>(settings.receive_buffer_target_duration).count();
+    std::size_t       size        = receive_buffer_size_;
+
+    if (buffer_filled && (size < max_size))
+      size = (std::min)(size * 2, max_size);
+    else if ((length < size / 4) && (target_size < static_cast<double>(size / 4)) && (size > settings.min_receive_buffer_size))
+      size = (std::max)(size / 2, settings.min_receive_buffer_size);
+
+    receive_buffer_size_ = size;
+  }
 
   void FtpSession::writeDataToFile(const std::shared_ptr<std::vector<char>>& data, const std::shared_ptr<WriteableFile>& file, const std::function<void(void)>& fetch_more)
   {
-    fetch_more();
-    file->write(data->data(), data->size());
+    // The data is written asynchronously, so a slow disk doesn't block the
+    // thread that serves the sockets. We keep reading from the socket while
+    // the write is in progress, unless there are too many writes pending
+    // already (e.g. because the disk is slower than the network). Not reading
+    // from the socket makes TCP flow control slow down the client.
+    ++file_writes_in_flight_;
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    if (server_context_.io_uring)
+    {
+      // Hand the data over to the kernel
+      server_context_.io_uring->asyncWrite(file->handle(), data, file->reserve(data->size())
+                                         , data_socket_strand_.wrap([me = shared_from_this(), data](int result)
+                                           {
+                                             me->onFileWriteComplete(result);
+                                           }));
+    }
+    else
+#endif // FINEFTP_SERVER_USE_IO_URING
+    {
+      // Let the disk writer pool write the data. The buffers of an upload are
+      // written one after another in the order they have been received.
+      file_write_queue_.push_back(data);
+      if (file_write_queue_.size() == 1)
+        writeNextQueuedData(file);
+    }
+
+    if (file_writes_in_flight_ < server_context_.settings.max_file_writes_in_flight)
+      fetch_more();
+    else
+      deferred_fetch_more_ = fetch_more;
+  }
+
+  void FtpSession::writeNextQueuedData(const std::shared_ptr<WriteableFile>& file)
+  {
+    // Everything that has been queued is written at once, so a disk that
+    // cannot keep up with the network is fed with larger writes.
+    const std::vector<std::shared_ptr<std::vector<char>>> buffers(file_write_queue_.begin(), file_write_queue_.end());
+
+    asio::post(*server_context_.disk_writer_pool, [me = shared_from_this(), file, buffers]()
+                                                  {
+                                                    file->write(buffers);
+                                                    const bool good = file->good();
+
+                                                    asio::post(me->data_socket_strand_, [me, file, buffers, good]()
+                                                                                        {
+                                                                                          me->file_write_queue_.erase(me->file_write_queue_.begin(), me->file_write_queue_.begin() + static_cast<std::ptrdiff_t>(buffers.size()));
+                                                                                          if (!me->file_write_queue_.empty())
+                                                                                            me->writeNextQueuedData(file);
+
+                                                                                          for (const auto& buffer : buffers)
+                                                                                            me->onFileWriteComplete(good ? static_cast<int>(buffer->size()) : -EIO);
+                                                                                        });
+                                                  });
+  }
+
+  void FtpSession::onFileWriteComplete(int result)
+  {
+    --file_writes_in_flight_;
+    if ((result < 0) && (file_write_error_ == 0))
+    {
+      file_write_error_ = -result;
+    }
+
+    if (deferred_fetch_more_)
+    {
+      const std::function<void()> fetch_more = std::move(deferred_fetch_more_);
+      deferred_fetch_more_ = nullptr;
+      fetch_more();
+    }
+
+    if ((file_writes_in_flight_ == 0) && file_writes_done_handler_)
+    {
+      const std::function<void()> done_handler = std::move(file_writes_done_handler_);
+      file_writes_done_handler_ = nullptr;
+      done_handler();
+    }
   }
 
-  void FtpSession::endDataReceiving(const std::shared_ptr<WriteableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+  void FtpSession::endDataReceiving(const std::shared_ptr<WriteableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, const asio::error_code& ec)
   {
-    asio::post(data_socket_strand_, [me = shared_from_this(), file, data_socket]()
+    asio::post(data_socket_strand_, [me = shared_from_this(), file, data_socket, ec]()
                              {
-                               file->close();
-                               me->sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
-                               me->closeDataSocket(data_socket);
+                               // Only an upload that the client has ended by
+                               // closing the data connection is complete.
+                               // Anything else (a reset connection, a timeout,
+                               // a cancelled operation) leaves it truncated.
+                               me->receive_error_ = ((ec == asio::error::eof) ? asio::error_code() : ec);
+
+                               // The file must not be committed or closed while it is still being written to
+                               if (me->file_writes_in_flight_ > 0)
+                               {
+                                 me->file_writes_done_handler_ = [me, file, data_socket]() { me->commitReceivedFile(file, data_socket); };
+                                 return;
+                               }
+                               me->commitReceivedFile(file, data_socket);
                              });
   }
 
+  void FtpSession::commitReceivedFile(const std::shared_ptr<WriteableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket)
+  {
+    // An incomplete upload is never put in place
+    if ((file_write_error_ != 0) || receive_error_)
+    {
+      finishReceivedFile(file, data_socket, false);
+      return;
+    }
+
+    // The upload is only reported as complete once it is as durable as
+    // configured. Syncing blocks, so it is never done on the io threads.
+    switch (server_context_.settings.durability_policy)
+    {
+    case DurabilityPolicy::SyncOnClose:
+      asio::post(*server_context_.disk_writer_pool, [me = shared_from_this(), file, data_socket]()
+                                                    {
+                                                      const bool committed = file->commit(true);
+                                                      if (committed)
+                                                        ++me->durable_uploads_;
+                                                      asio::post(me->data_socket_strand_, [me, file, data_socket, committed]() { me->finishReceivedFile(file, data_socket, committed); });
+                                                    });
+      return;
+
+    case DurabilityPolicy::GroupCommit:
+      server_context_.group_committer->commit(file, [me = shared_from_this(), file, data_socket](bool committed)
+                                                    {
+                                                      if (committed)
+                                                        ++me->durable_uploads_;
+                                                      asio::post(me->data_socket_strand_, [me, file, data_socket, committed]() { me->finishReceivedFile(file, data_socket, committed); });
+                                                    });
+      return;
+
+    case DurabilityPolicy::None:
+    default:
+      finishReceivedFile(file, data_socket, file->commit());
+      return;
+    }
+  }
+
+  void FtpSession::finishReceivedFile(const std::shared_ptr<WriteableFile>& file, const std::shared_ptr<asio::ip::tcp::socket>& data_socket, bool committed)
+  {
+    const int              write_error   = file_write_error_;
+    const asio::error_code receive_error = receive_error_;
+    file_write_error_ = 0;
+    receive_error_    = asio::error_code();
+    if (write_error != 0)
+    {
+      file->close();
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error writing file: " + std::string(std::strerror(write_error)));
+    }
+    else if (receive_error)
+    {
+      // An incomplete upload must not replace the target of an atomic upload
+      file->close();
+      sendFtpMessage(FtpReplyCode::TRANSFER_ABORTED, "Data transfer aborted: " + receive_error.message());
+    }
+    else if (!committed)
+    {
+      sendFtpMessage(FtpReplyCode::ACTION_ABORTED_LOCAL_ERROR, "Error storing file");
+    }
+    else
+    {
+      sendFtpMessage(FtpReplyCode::CLOSING_DATA_CONNECTION, "Done");
+    }
+    closeDataSocket(data_socket);
+
+    // The size and time of the file have changed
+    server_context_.listing_cache->invalidate(file->filename());
+  }
+
+  ////////////////////////////////////////////////////////
+  // Bandwidth limiting
+  ////////////////////////////////////////////////////////
+
+  bool FtpSession::isBandwidthLimited() const
+  {
+    return (server_context_.bandwidth_limit || user_bandwidth_limit_);
+  }
+
+  std::chrono::steady_clock::duration FtpSession::bandwidthDelay() const
+  {
+    auto delay = std::chrono::steady_clock::duration::zero();
+    if (server_context_.bandwidth_limit)
+      delay = (std::max)(delay, server_context_.bandwidth_limit->delay());
+    if (user_bandwidth_limit_)
+      delay = (std::max)(delay, user_bandwidth_limit_->delay());
+    return delay;
+  }
+
+  void FtpSession::consumeBandwidth(std::size_t bytes) const
+  {
+    if (server_context_.bandwidth_limit)
+      server_context_.bandwidth_limit->consume(bytes);
+    if (user_bandwidth_limit_)
+      user_bandwidth_limit_->consume(bytes);
+  }
+
+  std::size_t FtpSession::bandwidthChunkSize(std::size_t max_size) const
+  {
+    // Small chunks let the transfers that share a limit take turns
+    std::size_t chunk_size = max_size;
+    if (server_context_.bandwidth_limit)
+      chunk_size = (std::min)(chunk_size, server_context_.bandwidth_limit->chunkSize());
+    if (user_bandwidth_limit_)
+      chunk_size = (std::min)(chunk_size, user_bandwidth_limit_->chunkSize());
+    return chunk_size;
+  }
+
+  ////////////////////////////////////////////////////////
+  // Page cache usage
+  ////////////////////////////////////////////////////////
+
+  bool FtpSession::isColdStreaming(const ReadableFile& file) const
+  {
+    // Files that are read once (e.g. backups) shouldn't push the files that
+    // everyone else needs out of the page cache
+    const std::size_t threshold = server_context_.settings.cold_streaming_threshold;
+    return (user_cold_streaming_ || ((threshold > 0) && (file.size() >= threshold)));
+  }
+
+  void FtpSession::dropSentFromCache(const ReadableFile& file, std::size_t begin, std::size_t end) const
+  {
+    // The pages that have just been sent are still in use for a while (e.g.
+    // referenced by the socket buffer until the client has acknowledged them)
+    // and the kernel would refuse to drop them. Thus, we drop the pages that
+    // have been sent a bit earlier. The kernel also only drops huge pages
+    // (folios) that are covered completely, so we drop whole blocks.
+    const std::size_t block_size = server_context_.settings.cold_streaming_block_size;
+    const std::size_t drop_begin = ((begin / block_size) > 0 ? (begin / block_size) - 1 : 0) * block_size;
+    const std::size_t drop_end   = ((end == file.size()) ? end : ((end / block_size) > 0 ? (end / block_size) - 1 : 0) * block_size);
+    if (drop_end > drop_begin)
+    {
+      file.dropFromCache(drop_begin, drop_end - drop_begin);
+    }
+  }
+
   ////////////////////////////////////////////////////////
   // Helpers
   ////////////////////////////////////////////////////////
@@ -1661,6 +3161,76 @@ namespace fineftp
     return output;
   }
 
+  std::string FtpSession::machineListingFacts(const Filesystem::FileStatus& file_status, const std::string& type, const std::vector<std::string>& facts, Permission permissions)
+  {
+    const auto has_permission = [permissions](Permission permission) { return static_cast<int>(permissions & permission) != 0; };
+    const bool is_dir = (file_status.type() == Filesystem::FileType::Dir);
+
+    std::stringstream facts_stream;
+    for (const auto& fact : facts)
+    {
+      if (fact == "type")
+      {
+        facts_stream << "type=";
+        if (!type.empty())
+          facts_stream << type;
+        else
+        {
+          switch (file_status.type())
+          {
+          case Filesystem::FileType::Dir:             facts_stream << "dir";            break;
+          case Filesystem::FileType::CharacterDevice: facts_stream << "OS.unix=chr";    break;
+          case Filesystem::FileType::BlockDevice:     facts_stream << "OS.unix=blk";    break;
+          case Filesystem::FileType::Fifo:            facts_stream << "OS.unix=fifo";   break;
+          case Filesystem::FileType::SymbolicLink:    facts_stream << "OS.unix=slink";  break;
+          case Filesystem::FileType::Socket:          facts_stream << "OS.unix=socket"; break;
+          default:                                    facts_stream << "file";           break;
+          }
+        }
+        facts_stream << ";";
+      }
+      else if ((fact == "size") && !is_dir)
+      {
+        facts_stream << "size=" << file_status.fileSize() << ";";
+      }
+      else if (fact == "modify")
+      {
+        facts_stream << "modify=" << file_status.generalizedTimeString() << ";";
+      }
+      else if (fact == "perm")
+      {
+        // The operations the logged in user may execute on the entry (RFC 3659, 7.5.5)
+        facts_stream << "perm=";
+        if (is_dir)
+        {
+          if (has_permission(Permission::FileWrite))  facts_stream << 'c';
+          if (has_permission(Permission::DirDelete))  facts_stream << 'd';
+          if (has_permission(Permission::DirList))    facts_stream << "el";
+          if (has_permission(Permission::DirRename))  facts_stream << 'f';
+          if (has_permission(Permission::DirCreate))  facts_stream << 'm';
+          if (has_permission(Permission::FileDelete)) facts_stream << 'p';
+        }
+        else
+        {
+          if (has_permission(Permission::FileAppend)) facts_stream << 'a';
+          if (has_permission(Permission::FileDelete)) facts_stream << 'd';
+          if (has_permission(Permission::FileRename)) facts_stream << 'f';
+          if (has_permission(Permission::FileRead))   facts_stream << 'r';
+          if (has_permission(Permission::FileWrite) && has_permission(Permission::FileDelete)) facts_stream << 'w'; // Overwriting needs both
+        }
+        facts_stream << ";";
+      }
+      else if (fact == "unique")
+      {
+        const std::string unique_id = file_status.uniqueId();
+        if (!unique_id.empty())
+          facts_stream << "unique=" << unique_id << ";";
+      }
+    }
+
+    return facts_stream.str();
+  }
+
   FtpMessage FtpSession::checkIfPathIsRenamable(const std::string& ftp_path) const
   {
     if (!logged_in_user_) return FtpMessage(FtpReplyCode::NOT_LOGGED_IN, "Not logged in");
@@ -2,6 +2,9 @@
 
 #include <asio.hpp> // IWYU pragma: keep
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <deque>
 #include <functional>
@@ -17,6 +20,7 @@
 #include "filesystem.h"
 #include "user_database.h"
 #include "ftp_user.h"
+#include "server_context.h"
 
 #ifdef _WIN32
   #include "win_str_convert.h"
@@ -24,6 +28,7 @@
 
 namespace fineftp
 {
+  class FileWindow;
   class ReadableFile;
   class WriteableFile;
 
@@ -36,7 +41,7 @@ namespace fineftp
   // Public API
   ////////////////////////////////////////////////////////
   public:
-    FtpSession(asio::io_context& io_context, const UserDatabase& user_database, const std::function<void()>& completion_handler, std::ostream& output, std::ostream& error);
+    FtpSession(asio::io_context& io_context, const UserDatabase& user_database, ServerContext& server_context, const std::function<void()>& completion_handler, std::ostream& output, std::ostream& error);
 
     // Copy (disabled, as we are inheriting from shared_from_this)
     FtpSession(const FtpSession&)            = delete;
@@ -90,6 +95,11 @@ namespace fineftp
     void handleFtpCommandSTOR(const std::string& param);
     void handleFtpCommandSTOU(const std::string& param);
     void handleFtpCommandAPPE(const std::string& param);
+    void resumeFileUpload(const std::string& param, std::uint64_t offset, std::uint64_t allocation_size);
+
+    bool preallocateUpload(const std::shared_ptr<WriteableFile>& file, std::uint64_t allocation_size);
+
+    std::shared_ptr<WriteableFile> createUploadFile(const std::string& local_path, std::ios::openmode open_mode);
     void handleFtpCommandALLO(const std::string& param);
     void handleFtpCommandREST(const std::string& param);
     void handleFtpCommandRNFR(const std::string& param);
@@ -114,15 +124,90 @@ namespace fineftp
 
     void handleFtpCommandMDTM(const std::string& param);
 
+    void handleFtpCommandMLSD(const std::string& param);
+    void handleFtpCommandMLST(const std::string& param);
+
   ////////////////////////////////////////////////////////
   // FTP data-socket send
   ////////////////////////////////////////////////////////
   private:
 
-    void sendDirectoryListing   (const std::map<std::string, Filesystem::FileStatus>& directory_content);
-    void sendNameList           (const std::map<std::string, Filesystem::FileStatus>& directory_content);
+    /** Format of a directory listing that is sent over the data connection */
+    enum class ListingFormat
+    {
+      List,           ///< ls-like lines of LIST
+      NameList,       ///< Only the names (NLST)
+      MachineListing  ///< Facts and names (MLSD)
+    };
+
+    /** A directory listing that is being sent */
+    struct DirectoryListing;
+
+    /** Entries of a directory listing that are formatted and sent together */
+    struct DirectoryListingBatch;
+
+    std::string listingCacheVariant(ListingFormat format) const;
+
+    /**
+     * @brief Sends the listing of a directory from the listing cache
+     *
+     * On a miss, nothing is sent and the generation that has to be passed to
+     * sendDirectoryListing() is returned.
+     *
+     * @return true, if the listing has been sent
+     */
+    bool sendCachedDirectoryListing(const std::string&                         local_path
+                                  , ListingFormat                              format
+                                  , const std::string&                         message
+                                  , std::uint64_t&                             cache_generation);
+
+    void sendDirectoryListing   (std::unique_ptr<Filesystem::DirectoryReader>  directory_reader
+                               , ListingFormat                                 format
+                               , const std::string&                            local_path
+                               , std::uint64_t                                 cache_generation);
+
+    void sendDirectoryListingBatch(const std::shared_ptr<DirectoryListing>&    listing
+                                 , const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
+
+    void formatDirectoryListingPart(const std::shared_ptr<DirectoryListing>&      listing
+                                  , const std::shared_ptr<DirectoryListingBatch>& batch
+                                  , std::size_t                                   begin
+                                  , std::size_t                                   end
+                                  , const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
+
+    void writeDirectoryListingBatch(const std::shared_ptr<DirectoryListing>&      listing
+                                  , const std::shared_ptr<DirectoryListingBatch>& batch
+                                  , const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
 
-    void sendFile               (const std::shared_ptr<ReadableFile>&          file);
+    void sendFile               (const std::shared_ptr<ReadableFile>&          file
+                               , std::size_t                                   offset);
+
+    void sendFileMapped         (const std::shared_ptr<ReadableFile>&          file
+                               , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                               , const std::shared_ptr<FileWindow>&            window);
+
+    void loadFileWindow         (const std::shared_ptr<ReadableFile>&          file
+                               , const std::shared_ptr<FileWindow>&            window
+                               , std::size_t                                   offset
+                               , const std::function<void()>&                  loaded_handler);
+
+    void sendFileWindow         (const std::shared_ptr<ReadableFile>&          file
+                               , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                               , const std::shared_ptr<FileWindow>&            window);
+
+#ifdef __linux__
+    void sendFileZeroCopy       (const std::shared_ptr<ReadableFile>&          file
+                               , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                               , std::size_t                                   offset);
+
+    void sendFileZeroCopyQuantum(const std::shared_ptr<ReadableFile>&          file
+                               , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                               , std::size_t                                   offset
+                               , std::size_t                                   quantum);
+#endif // __linux__
+
+
+    void endFileSending         (const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
 
     void acceptDataConnection   (const std::function<void(const std::shared_ptr<asio::ip::tcp::socket>&)>& connected_handler);
 
@@ -137,21 +222,89 @@ namespace fineftp
 
     void writeDataToSocket      (const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
 
+    void asyncWriteLimited      (const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                               , asio::const_buffer                            buffer
+                               , const std::function<void(asio::error_code)>&  handler);
+
+    void asyncWriteScheduled    (const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                               , asio::const_buffer                            buffer
+                               , const std::function<void(asio::error_code)>&  handler);
+
+    void asyncReadScheduled     (const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                               , asio::mutable_buffer                          buffer
+                               , const std::function<void(asio::error_code, std::size_t)>& handler);
+
   ////////////////////////////////////////////////////////
   // FTP data-socket receive
   ////////////////////////////////////////////////////////
   private:
-    void receiveFile(const std::shared_ptr<WriteableFile>& file);
+    void receiveFile(const std::shared_ptr<WriteableFile>& file, std::uint64_t size_hint);
+
+    void updateReceiveRate(std::size_t bytes, std::chrono::steady_clock::duration elapsed);
+
+    void adaptReceiveBufferSize(std::size_t length, bool buffer_filled);
 
     void receiveDataFromSocketAndWriteToFile(const std::shared_ptr<WriteableFile>&         file
                                            , const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
 
+#ifdef __linux__
+    /** Pipe that the data of an upload is spliced through from the data socket to the file */
+    struct SplicePipe;
+
+    bool canReceiveZeroCopy() const;
+
+    void receiveFileZeroCopy(const std::shared_ptr<WriteableFile>&         file
+                           , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                           , const std::shared_ptr<SplicePipe>&            pipe);
+
+    void receiveFileZeroCopyQuantum(const std::shared_ptr<WriteableFile>&         file
+                                  , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                                  , const std::shared_ptr<SplicePipe>&            pipe
+                                  , std::size_t                                   quantum
+                                  , std::chrono::steady_clock::time_point         wait_start);
+#endif // __linux__
+
     void writeDataToFile(const std::shared_ptr<std::vector<char>>& data
                        , const std::shared_ptr<WriteableFile>&     file
                        , const std::function<void(void)>&          fetch_more = []() {return; });
 
-    void endDataReceiving(const std::shared_ptr<WriteableFile>& file
-                        , const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
+    /**
+     * @brief Finishes the upload once all data has been written
+     *
+     * @param ec  The error that has ended receiving. Only asio::error::eof
+     *            (the client has closed the data connection) completes the
+     *            upload, any other error aborts it.
+     */
+    void endDataReceiving(const std::shared_ptr<WriteableFile>&         file
+                        , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                        , const asio::error_code&                       ec);
+
+    void commitReceivedFile(const std::shared_ptr<WriteableFile>&         file
+                          , const std::shared_ptr<asio::ip::tcp::socket>& data_socket);
+
+    void finishReceivedFile(const std::shared_ptr<WriteableFile>&         file
+                          , const std::shared_ptr<asio::ip::tcp::socket>& data_socket
+                          , bool                                          committed);
+
+    void writeNextQueuedData(const std::shared_ptr<WriteableFile>& file);
+
+    void onFileWriteComplete(int result);
+
+  ////////////////////////////////////////////////////////
+  // Bandwidth limiting
+  ////////////////////////////////////////////////////////
+  private:
+    bool isBandwidthLimited() const;
+    std::chrono::steady_clock::duration bandwidthDelay() const;
+    void consumeBandwidth(std::size_t bytes) const;
+    std::size_t bandwidthChunkSize(std::size_t max_size) const;
+
+  ////////////////////////////////////////////////////////
+  // Page cache usage
+  ////////////////////////////////////////////////////////
+  private:
+    bool isColdStreaming(const ReadableFile& file) const;
+    void dropSentFromCache(const ReadableFile& file, std::size_t begin, std::size_t end) const;
 
   ////////////////////////////////////////////////////////
   // Helpers
@@ -161,6 +314,19 @@ namespace fineftp
     std::string toLocalPath(const std::string& ftp_path) const;
     static std::string createQuotedFtpPath(const std::string& unquoted_ftp_path);
 
+    /**
+     * @brief Creates the facts of an MLSD / MLST entry
+     *
+     * Only the given facts (selected with OPTS MLST) are created. The result has the
+     * form "type=file;size=42;" and is directly followed by the entry name.
+     *
+     * @param file_status: The status of the file or directory
+     * @param type:        The value of the type fact (e.g. "cdir" for the listed directory itself), or empty to derive it from the file status
+     * @param facts:       The selected facts
+     * @param permissions: The permissions of the logged in user
+     */
+    static std::string machineListingFacts(const Filesystem::FileStatus& file_status, const std::string& type, const std::vector<std::string>& facts, Permission permissions);
+
     /** @brief Checks if a path is renamable
     *
     * Checks if the current user can rename the given path. A path is renameable
@@ -193,12 +359,19 @@ namespace fineftp
     // User management
     const UserDatabase&      user_database_;
     std::shared_ptr<FtpUser> logged_in_user_;
+    std::shared_ptr<TokenBucket> user_bandwidth_limit_; // Bandwidth limit of the logged in user, used by the data transfers
+    unsigned int             transfer_weight_;     // Share of the logged in user in the transfer scheduler
+    TransferScheduler::Flow  transfer_flow_;       // Queue and deficit of this session in the transfer scheduler
+    bool                     user_cold_streaming_; // Whether downloads of the logged in user are dropped from the page cache
+
+    // Server-wide settings and services
+    ServerContext&           server_context_;
 
     // "Global" io service
     asio::io_context&        io_context_;
 
     // Command Socket.
-    // Note that the command_strand_ is used to serialize access to all of the 9 member variables following it.
+    // Note that the command_strand_ is used to serialize access to all of the 10 member variables following it.
     asio::io_context::strand command_strand_;
     asio::ip::tcp::socket    command_socket_;
     asio::streambuf          command_input_stream_;
@@ -206,6 +379,9 @@ namespace fineftp
 
     std::string last_command_;
     std::string rename_from_path_;
+    std::uint64_t restart_offset_;     // Set by the REST command, consumed by the next transfer
+    std::uint64_t allocation_size_;    // Set by the ALLO command, consumed by the next upload
+    std::vector<std::string> mlst_facts_; // Facts of MLSD and MLST listings, selected by OPTS MLST
     std::string username_for_login_;
     bool        data_type_binary_;
     bool        shutdown_requested_; // Set to true when the client sends a QUIT command.
@@ -221,6 +397,21 @@ namespace fineftp
     std::weak_ptr<asio::ip::tcp::socket>           data_socket_weakptr_;
     std::deque<std::shared_ptr<std::vector<char>>> data_buffer_;
 
+    // Asynchronous writes of the current upload. Only accessed from the data_socket_strand_.
+    std::size_t                                    file_writes_in_flight_;
+    int                                            file_write_error_;          // errno of the first failed write
+    asio::error_code                               receive_error_;             // Error that has aborted receiving the upload, if it has not ended regularly
+    std::function<void()>                          deferred_fetch_more_;       // Continues reading from the socket once writes have completed
+    std::function<void()>                          file_writes_done_handler_;  // Finishes the upload once all writes have completed
+    std::deque<std::shared_ptr<std::vector<char>>> file_write_queue_;          // Buffers waiting for the disk writer pool, including the ones being written
+
+    // Adaptive read size of uploads. Atomic, as STAT reports them from the command strand.
+    std::atomic<std::size_t>                       receive_buffer_size_;       // Number of bytes read from the data socket at once
+    std::atomic<std::uint64_t>                     receive_rate_;              // Smoothed receive rate of the current (or last) upload in bytes per second
+
+    // Number of uploads that have been synced to the disk before 226 has been sent (see DurabilityPolicy). Reported by STAT.
+    std::atomic<std::uint64_t>                     durable_uploads_;
+
     asio::steady_timer                             timer_;
 
     std::ostream& output_;  /* Normal output log */
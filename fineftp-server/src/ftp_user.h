@@ -1,20 +1,37 @@
 #pragma once
 
 #include <fineftp/permissions.h>
+#include <fineftp/user_settings.h>
+
+#include <memory>
 #include <string>
 
+#include "token_bucket.h"
+
 namespace fineftp
 {
   struct FtpUser
   {
-    FtpUser(const std::string& password, const std::string& local_root_path, const Permission permissions)
+    FtpUser(const std::string& password, const std::string& local_root_path, const Permission permissions, const UserSettings& settings)
       : password_       (password)
       , local_root_path_(local_root_path)
       , permissions_    (permissions)
+      , bandwidth_limit_(settings.max_bytes_per_second > 0 ? std::make_shared<TokenBucket>(settings.max_bytes_per_second) : nullptr)
+      , transfer_weight_(settings.transfer_weight > 0 ? settings.transfer_weight : 1)
+      , cold_streaming_ (settings.cold_streaming)
     {}
 
     const std::string password_;
     const std::string local_root_path_;
     const Permission permissions_;
+
+    // Shared by all sessions of the user. nullptr, if the bandwidth is not limited.
+    const std::shared_ptr<TokenBucket> bandwidth_limit_;
+
+    // Number of quanta the transfers of the user get per round in the transfer scheduler
+    const unsigned int transfer_weight_;
+
+    // Whether the files downloaded by the user are dropped from the page cache
+    const bool cold_streaming_;
   };
 }
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "group_committer.h"
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <file_man.h>
+
+namespace fineftp
+{
+  GroupCommitter::GroupCommitter()
+    : sync_scheduled_(false)
+    , thread_pool_   (1)
+  {}
+
+  GroupCommitter::~GroupCommitter()
+  {
+    thread_pool_.join();
+  }
+
+  void GroupCommitter::commit(const std::shared_ptr<WriteableFile>& file, const CommittedHandler& handler)
+  {
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      pending_files_.push_back(file);
+      pending_handlers_.push_back(handler);
+
+      // If a round is scheduled already, it will take this file, too
+      if (sync_scheduled_)
+        return;
+      sync_scheduled_ = true;
+    }
+
+    asio::post(thread_pool_, [this]() { commitPending(); });
+  }
+
+  void GroupCommitter::commitPending()
+  {
+    // Take everything that has been requested so far. Files requested while
+    // this round is committing are collected for the next round.
+    std::vector<std::shared_ptr<WriteableFile>> files;
+    std::vector<CommittedHandler>               handlers;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      files.swap(pending_files_);
+      handlers.swap(pending_handlers_);
+    }
+
+    const std::vector<bool> committed = WriteableFile::commit(files);
+
+    for (std::size_t i = 0; i < handlers.size(); i++)
+      handlers[i](committed[i]);
+
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      if (pending_files_.empty())
+      {
+        sync_scheduled_ = false;
+        return;
+      }
+    }
+
+    asio::post(thread_pool_, [this]() { commitPending(); });
+  }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <file_man.h>
+
+namespace fineftp
+{
+  /**
+   * @brief Makes uploaded files durable and puts them in place in batches
+   *
+   * Syncing every uploaded file on its own costs at least one disk flush per
+   * file, which limits the throughput of small uploads to a few hundred files
+   * per second. The group committer commits files on a background thread.
+   * While a round is in progress, new requests are collected and committed
+   * together in the next round (see WriteableFile::commit()). On Linux 5.8
+   * and newer, a round flushes each file system twice (once for the data,
+   * once for the renames), no matter how many files it commits, so the
+   * number of flushes depends on the disk latency rather than on the number
+   * of uploads. Elsewhere, the data of each file is flushed on its own and
+   * only the directory syncs are shared by the files of a round.
+   *
+   * The group committer is thread safe.
+   */
+  class GroupCommitter
+  {
+  public:
+    /** Called from the background thread once the file has been committed. The parameter tells whether the file is durably in place. Must not block. */
+    using CommittedHandler = std::function<void(bool)>;
+
+    GroupCommitter();
+
+    // Copy / Move disabled
+    GroupCommitter(const GroupCommitter&)            = delete;
+    GroupCommitter& operator=(const GroupCommitter&) = delete;
+    GroupCommitter(GroupCommitter&&)                 = delete;
+    GroupCommitter& operator=(GroupCommitter&&)      = delete;
+
+    /** Commits the files that are still pending */
+    ~GroupCommitter();
+
+    /**
+     * @brief Makes the written data of the file durable and puts the file in place
+     *
+     * @param file      The file to commit. It must not be used anymore until the handler has been called.
+     * @param handler   Called when the file has been committed.
+     */
+    void commit(const std::shared_ptr<WriteableFile>& file, const CommittedHandler& handler);
+
+  private:
+    void commitPending();
+
+  private:
+    std::mutex                                  mutex_;
+    std::vector<std::shared_ptr<WriteableFile>> pending_files_;
+    std::vector<CommittedHandler>               pending_handlers_;
+    bool                                        sync_scheduled_;    ///< Whether a round has been posted that will pick up the pending files
+
+    asio::thread_pool thread_pool_;
+  };
+}
@@ -0,0 +1,347 @@
+#include "listing_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+  #include <array>
+  #include <cstring>
+
+  #include <sys/inotify.h>
+  #include <unistd.h>
+#elif defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+
+  #include "win_str_convert.h"
+#else
+  #include <sys/stat.h>
+#endif // __linux__
+
+namespace fineftp
+{
+  namespace
+  {
+#ifdef _WIN32
+    constexpr const char* path_separators = "\\/";
+#else // _WIN32
+    constexpr const char* path_separators = "/";
+#endif // _WIN32
+
+#ifdef __linux__
+    // Everything that changes the listing of the watched directory. Writes
+    // to files are included, as they change the size and time of the entry.
+    constexpr std::uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                                       | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE
+                                       | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+#else // __linux__
+    /// Reads the modification time (in the full resolution of the file
+    /// system) and the size of a directory. Returns false, if the path is not
+    /// a directory.
+    bool directoryVersion(const std::string& local_path, std::int64_t& modification_time, std::int64_t& size)
+    {
+#ifdef _WIN32
+      WIN32_FILE_ATTRIBUTE_DATA file_attributes;
+#if !defined(__GNUG__)
+      if (0 == ::GetFileAttributesExW(StrConvert::Utf8ToWide(local_path).c_str(), GetFileExInfoStandard, &file_attributes))
+#else
+      if (0 == ::GetFileAttributesExA(local_path.c_str(), GetFileExInfoStandard, &file_attributes))
+#endif
+        return false;
+
+      if ((file_attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+        return false;
+
+      modification_time = static_cast<std::int64_t>((static_cast<std::uint64_t>(file_attributes.ftLastWriteTime.dwHighDateTime) << 32) | file_attributes.ftLastWriteTime.dwLowDateTime);
+      size              = static_cast<std::int64_t>((static_cast<std::uint64_t>(file_attributes.nFileSizeHigh) << 32) | file_attributes.nFileSizeLow);
+#else // _WIN32
+      struct stat file_status {};
+      if ((0 != ::stat(local_path.c_str(), &file_status)) || !S_ISDIR(file_status.st_mode))
+        return false;
+
+#if (defined(__APPLE__) && defined(__MACH__)) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+      modification_time = (static_cast<std::int64_t>(file_status.st_mtimespec.tv_sec) * 1000000000) + static_cast<std::int64_t>(file_status.st_mtimespec.tv_nsec);
+#else
+      modification_time = (static_cast<std::int64_t>(file_status.st_mtim.tv_sec) * 1000000000) + static_cast<std::int64_t>(file_status.st_mtim.tv_nsec);
+#endif
+      size              = static_cast<std::int64_t>(file_status.st_size);
+#endif // _WIN32
+      return true;
+    }
+#endif // __linux__
+  }  // namespace
+
+  ListingCache::ListingCache(std::size_t max_bytes, std::size_t max_directories)
+    : max_bytes_      (max_bytes)
+    , max_directories_(max_directories)
+    , cached_bytes_   (0)
+    , last_generation_(0)
+#ifdef __linux__
+    , inotify_fd_     (-1)
+#endif // __linux__
+    , hit_count_      (0)
+    , miss_count_     (0)
+  {
+#ifdef __linux__
+    // The events are read without blocking whenever the cache is used, so we
+    // don't need a thread for watching
+    if (isEnabled())
+      inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif // __linux__
+  }
+
+  ListingCache::~ListingCache()
+  {
+#ifdef __linux__
+    if (inotify_fd_ >= 0)
+      close(inotify_fd_);
+#endif // __linux__
+  }
+
+  bool ListingCache::isEnabled() const
+  {
+    return (max_bytes_ > 0) && (max_directories_ > 0);
+  }
+
+  std::size_t ListingCache::maxListingSize() const
+  {
+    return max_bytes_;
+  }
+
+  std::shared_ptr<std::vector<char>> ListingCache::get(const std::string& local_path, const std::string& variant, std::uint64_t& generation)
+  {
+    generation = 0;
+
+    if (!isEnabled())
+      return nullptr;
+
+#ifdef __linux__
+    // Without inotify, we would not notice any changes
+    if (inotify_fd_ < 0)
+      return nullptr;
+#else // __linux__
+    // Checking the directory is done without holding the lock
+    std::int64_t modification_time = 0;
+    std::int64_t size              = 0;
+    const bool   is_directory      = directoryVersion(local_path, modification_time, size);
+#endif // __linux__
+
+    const std::lock_guard<std::mutex> lock(mutex_);
+
+#ifdef __linux__
+    processEvents();
+#else // __linux__
+    // Paths that are no directory (anymore) must not take the place of
+    // cached directories
+    if (!is_directory)
+    {
+      auto directory_it = directories_.find(local_path);
+      if (directory_it != directories_.end())
+        erase(directory_it->second);
+      return nullptr;
+    }
+#endif // __linux__
+
+    auto directory_it = directories_.find(local_path);
+    if (directory_it != directories_.end())
+    {
+      Directory& directory = *directory_it->second;
+      lru_.splice(lru_.begin(), lru_, directory_it->second);
+
+#ifndef __linux__
+      if ((directory.modification_time != modification_time) || (directory.size != size))
+      {
+        clear(directory);
+        directory.modification_time = modification_time;
+        directory.size              = size;
+      }
+#endif // !__linux__
+
+      auto listing_it = directory.listings.find(variant);
+      if (listing_it != directory.listings.end())
+      {
+        hit_count_++;
+        return listing_it->second;
+      }
+
+      miss_count_++;
+      generation = directory.generation;
+      return nullptr;
+    }
+
+    miss_count_++;
+
+    // Start watching the directory before the listing is created, so no
+    // change can get lost
+#ifdef __linux__
+    const int watch_descriptor = inotify_add_watch(inotify_fd_, local_path.c_str(), watch_mask);
+    if (watch_descriptor < 0)
+      return nullptr; // e.g. not a directory (IN_ONLYDIR) or the maximum number of watches has been reached
+
+    // Another path leads to the same directory and already uses the watch
+    if (watches_.find(watch_descriptor) != watches_.end())
+      return nullptr;
+#endif // __linux__
+
+    Directory directory;
+    directory.local_path        = local_path;
+    directory.generation        = ++last_generation_;
+#ifdef __linux__
+    directory.watch_descriptor  = watch_descriptor;
+#else // __linux__
+    directory.modification_time = modification_time;
+    directory.size              = size;
+#endif // __linux__
+    directory.bytes             = 0;
+
+    lru_.push_front(std::move(directory));
+    directories_.emplace(local_path, lru_.begin());
+#ifdef __linux__
+    watches_[watch_descriptor] = lru_.begin();
+#endif // __linux__
+    evict();
+
+    generation = lru_.front().generation;
+    return nullptr;
+  }
+
+  void ListingCache::put(const std::string& local_path, const std::string& variant, std::uint64_t generation, const std::shared_ptr<std::vector<char>>& listing)
+  {
+    if ((generation == 0) || (listing->size() > max_bytes_))
+      return;
+
+    const std::lock_guard<std::mutex> lock(mutex_);
+
+#ifdef __linux__
+    // The directory may have changed while the listing was created
+    processEvents();
+#endif // __linux__
+
+    auto directory_it = directories_.find(local_path);
+    if ((directory_it == directories_.end()) || (directory_it->second->generation != generation))
+      return;
+
+    Directory& directory = *directory_it->second;
+    auto& cached_listing = directory.listings[variant];
+    if (cached_listing)
+    {
+      directory.bytes -= cached_listing->size();
+      cached_bytes_   -= cached_listing->size();
+    }
+
+    cached_listing   = listing;
+    directory.bytes += listing->size();
+    cached_bytes_   += listing->size();
+    evict();
+  }
+
+  void ListingCache::invalidate(const std::string& local_path)
+  {
+    if (!isEnabled())
+      return;
+
+    // The path is an entry of its parent directory and may be a directory
+    // itself (e.g. after MKD or RMD)
+    const std::size_t separator = local_path.find_last_of(path_separators);
+    const std::string parent_path = ((separator == std::string::npos) ? std::string() : local_path.substr(0, (separator == 0) ? 1 : separator));
+
+    const std::lock_guard<std::mutex> lock(mutex_);
+    for (const std::string& path : { local_path, parent_path })
+    {
+      auto directory_it = directories_.find(path);
+      if (directory_it != directories_.end())
+        clear(*directory_it->second);
+    }
+  }
+
+  std::uint64_t ListingCache::hitCount() const
+  {
+    return hit_count_;
+  }
+
+  std::uint64_t ListingCache::missCount() const
+  {
+    return miss_count_;
+  }
+
+  void ListingCache::clear(Directory& directory)
+  {
+    cached_bytes_       -= directory.bytes;
+    directory.bytes      = 0;
+    directory.listings.clear();
+    directory.generation = ++last_generation_;
+  }
+
+  void ListingCache::erase(std::list<Directory>::iterator directory_it)
+  {
+    cached_bytes_ -= directory_it->bytes;
+#ifdef __linux__
+    inotify_rm_watch(inotify_fd_, directory_it->watch_descriptor);
+    watches_.erase(directory_it->watch_descriptor);
+#endif // __linux__
+    directories_.erase(directory_it->local_path);
+    lru_.erase(directory_it);
+  }
+
+  void ListingCache::evict()
+  {
+    while (!lru_.empty() && ((cached_bytes_ > max_bytes_) || (lru_.size() > max_directories_)))
+    {
+      erase(std::prev(lru_.end()));
+    }
+  }
+
+#ifdef __linux__
+  void ListingCache::processEvents()
+  {
+    alignas(inotify_event) std::array<char, 4096> buffer{};
+
+    for (;;)
+    {
+      const ssize_t length = read(inotify_fd_, buffer.data(), buffer.size());
+      if (length <= 0)
+        return; // No more events (EAGAIN)
+
+      for (ssize_t offset = 0; offset < length;)
+      {
+        inotify_event event{};
+        std::memcpy(&event, buffer.data() + offset, sizeof(inotify_event));
+        offset += static_cast<ssize_t>(sizeof(inotify_event) + event.len);
+
+        if ((event.mask & IN_Q_OVERFLOW) != 0)
+        {
+          // Events have been lost, so we don't know what has changed
+          for (auto& directory : lru_)
+            clear(directory);
+          continue;
+        }
+
+        auto watch_it = watches_.find(event.wd);
+        if (watch_it == watches_.end())
+          continue;
+
+        if ((event.mask & IN_IGNORED) != 0)
+        {
+          // The directory has been removed, which also removed the watch
+          const auto directory_it = watch_it->second;
+          cached_bytes_ -= directory_it->bytes;
+          watches_.erase(watch_it);
+          directories_.erase(directory_it->local_path);
+          lru_.erase(directory_it);
+          continue;
+        }
+
+        clear(*watch_it->second);
+      }
+    }
+  }
+#endif // __linux__
+}
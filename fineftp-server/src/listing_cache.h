@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fineftp
+{
+  /**
+   * @brief Keeps the formatted listings of recently listed directories
+   *
+   * Clients that poll a directory every few seconds make the server read
+   * the directory, stat all of its entries and format the listing again and
+   * again, although nothing has changed. The cache keeps the formatted
+   * listings (the exact bytes sent over the data connection), so repeated
+   * listings are sent straight from memory.
+   *
+   * A directory can have multiple listings, one per variant (e.g. LIST,
+   * NLST and MLSD with certain facts).
+   *
+   * On Linux, every cached directory is watched with inotify. Any change of
+   * the directory or its entries (including writes to files, as they change
+   * the sizes and times in the listing) invalidates its listings, so a cache
+   * hit does not touch the filesystem at all. On other platforms, the
+   * modification time (in full resolution) and the size of the directory
+   * are checked with a stat before a listing is served. As they don't change
+   * when an existing file is modified, sessions invalidate() the paths they
+   * change. Paths that are not directories are never cached.
+   *
+   * The cache is bounded by the number of directories and by the sum of the
+   * sizes of the listings. The least recently used directories are dropped
+   * first. With a limit of 0 the cache is disabled.
+   *
+   * The cache is thread safe.
+   */
+  class ListingCache
+  {
+  public:
+    /**
+     * @param max_bytes         Maximum sum of the sizes of the cached listings.
+     * @param max_directories   Maximum number of cached directories.
+     */
+    ListingCache(std::size_t max_bytes, std::size_t max_directories);
+
+    // Copy / Move disabled
+    ListingCache(const ListingCache&)            = delete;
+    ListingCache& operator=(const ListingCache&) = delete;
+    ListingCache(ListingCache&&)                 = delete;
+    ListingCache& operator=(ListingCache&&)      = delete;
+
+    ~ListingCache();
+
+    /** @brief Returns whether listings are cached at all */
+    bool isEnabled() const;
+
+    /** @brief Returns the size of the largest listing that can be cached */
+    std::size_t maxListingSize() const;
+
+    /**
+     * @brief Returns the cached listing of a directory
+     *
+     * On a miss, the directory starts being watched. The listing has to be
+     * created afterwards and can then be added with put(), which only accepts
+     * it if the directory has not changed in the meantime.
+     *
+     * @param local_path  The (UTF-8 encoded) local path of the directory.
+     * @param variant     The variant of the listing.
+     * @param generation  Set to the value that has to be passed to put() on a miss.
+     *
+     * @return The listing or nullptr. The listing must not be modified.
+     */
+    std::shared_ptr<std::vector<char>> get(const std::string& local_path, const std::string& variant, std::uint64_t& generation);
+
+    /**
+     * @brief Adds the listing of a directory
+     *
+     * @param local_path  The (UTF-8 encoded) local path of the directory.
+     * @param variant     The variant of the listing.
+     * @param generation  The value returned by the get() that missed.
+     * @param listing     The listing. Must not be modified afterwards.
+     */
+    void put(const std::string& local_path, const std::string& variant, std::uint64_t generation, const std::shared_ptr<std::vector<char>>& listing);
+
+    /**
+     * @brief Drops the listings that the given path is part of
+     *
+     * These are the listings of the parent directory and, if the path is a
+     * directory, its own listings.
+     *
+     * @param local_path  The (UTF-8 encoded) local path of a file or directory.
+     */
+    void invalidate(const std::string& local_path);
+
+    /** @brief Returns the number of listings that have been served from the cache */
+    std::uint64_t hitCount() const;
+
+    /** @brief Returns the number of listings that had to be created */
+    std::uint64_t missCount() const;
+
+  private:
+    struct Directory
+    {
+      std::string                                                 local_path;
+      std::uint64_t                                               generation;       ///< Changes whenever the listings are invalidated
+#ifdef __linux__
+      int                                                         watch_descriptor;
+#else // __linux__
+      std::int64_t                                                modification_time; ///< Of the directory, in the full resolution of the file system
+      std::int64_t                                                size;              ///< Of the directory
+#endif // __linux__
+      std::map<std::string, std::shared_ptr<std::vector<char>>>   listings;         ///< By variant
+      std::size_t                                                 bytes;            ///< Sum of the sizes of the listings
+    };
+
+    void clear(Directory& directory);
+    void erase(std::list<Directory>::iterator directory_it);
+    void evict();
+
+#ifdef __linux__
+    void processEvents();
+#endif // __linux__
+
+  private:
+    const std::size_t max_bytes_;
+    const std::size_t max_directories_;
+
+    std::mutex                                                         mutex_;
+    std::list<Directory>                                               lru_;             ///< Most recently used directory first
+    std::unordered_map<std::string, std::list<Directory>::iterator>    directories_;
+    std::size_t                                                        cached_bytes_;
+    std::uint64_t                                                      last_generation_;
+
+#ifdef __linux__
+    int                                                                inotify_fd_;
+    std::unordered_map<int, std::list<Directory>::iterator>            watches_;         ///< Directories by watch descriptor
+#endif // __linux__
+
+    std::atomic<std::uint64_t> hit_count_;
+    std::atomic<std::uint64_t> miss_count_;
+  };
+}
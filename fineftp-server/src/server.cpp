@@ -9,7 +9,9 @@
 #include <ostream>
 #include <string>
 
+#include <fineftp/durability.h>
 #include <fineftp/permissions.h>
+#include <fineftp/user_settings.h>
 
 namespace fineftp
 {
@@ -36,11 +38,75 @@ namespace fineftp
     return ftp_server_->addUser(username, password, local_root_path, permissions);
   }
 
+  bool FtpServer::addUser(const std::string& username, const std::string& password, const std::string& local_root_path, const Permission permissions, const UserSettings& settings)
+  {
+    return ftp_server_->addUser(username, password, local_root_path, permissions, settings);
+  }
+
   bool FtpServer::addUserAnonymous(const std::string& local_root_path, const Permission permissions)
   {
     return ftp_server_->addUserAnonymous(local_root_path, permissions);
   }
 
+  bool FtpServer::addUserAnonymous(const std::string& local_root_path, const Permission permissions, const UserSettings& settings)
+  {
+    return ftp_server_->addUserAnonymous(local_root_path, permissions, settings);
+  }
+
+  void FtpServer::setFileWindowSize(size_t window_size)
+  {
+    assert(window_size > 0);
+    ftp_server_->setFileWindowSize(window_size);
+  }
+
+  void FtpServer::setMaxBytesPerSecond(size_t bytes_per_second)
+  {
+    ftp_server_->setMaxBytesPerSecond(bytes_per_second);
+  }
+
+  void FtpServer::setTransferQuantumSize(size_t quantum_size)
+  {
+    assert(quantum_size > 0);
+    ftp_server_->setTransferQuantumSize(quantum_size);
+  }
+
+  void FtpServer::setFileCacheLimits(size_t max_total_file_size, size_t max_entries)
+  {
+    ftp_server_->setFileCacheLimits(max_total_file_size, max_entries);
+  }
+
+  void FtpServer::setColdStreamingThreshold(size_t file_size)
+  {
+    ftp_server_->setColdStreamingThreshold(file_size);
+  }
+
+  void FtpServer::setDurabilityPolicy(DurabilityPolicy policy)
+  {
+    ftp_server_->setDurabilityPolicy(policy);
+  }
+
+  void FtpServer::setReceiveBufferSizeLimits(size_t min_size, size_t max_size)
+  {
+    assert((min_size > 0) && (min_size <= max_size));
+    ftp_server_->setReceiveBufferSizeLimits(min_size, max_size);
+  }
+
+  void FtpServer::setAtomicUploads(bool enable)
+  {
+    ftp_server_->setAtomicUploads(enable);
+  }
+
+  void FtpServer::setDirectoryListingThreadCount(size_t thread_count)
+  {
+    assert(thread_count > 0);
+    ftp_server_->setDirectoryListingThreadCount(thread_count);
+  }
+
+  void FtpServer::setDirectoryListingCacheLimits(size_t max_bytes, size_t max_directories)
+  {
+    ftp_server_->setDirectoryListingCacheLimits(max_bytes, max_directories);
+  }
+
   bool FtpServer::start(size_t thread_count)
   {
     assert(thread_count > 0);
@@ -57,6 +123,36 @@ namespace fineftp
     return ftp_server_->getOpenConnectionCount();
   }
 
+  uint64_t FtpServer::getFileCacheHitCount() const
+  {
+    return ftp_server_->getFileCacheHitCount();
+  }
+
+  uint64_t FtpServer::getFileCacheMissCount() const
+  {
+    return ftp_server_->getFileCacheMissCount();
+  }
+
+  uint64_t FtpServer::getDirectoryListingCacheHitCount() const
+  {
+    return ftp_server_->getDirectoryListingCacheHitCount();
+  }
+
+  uint64_t FtpServer::getDirectoryListingCacheMissCount() const
+  {
+    return ftp_server_->getDirectoryListingCacheMissCount();
+  }
+
+  size_t FtpServer::getReceiveBuffersInUseCount() const
+  {
+    return ftp_server_->getReceiveBuffersInUseCount();
+  }
+
+  size_t FtpServer::getReceiveBuffersAllocatedCount() const
+  {
+    return ftp_server_->getReceiveBuffersAllocatedCount();
+  }
+
   uint16_t FtpServer::getPort() const
   {
     return ftp_server_->getPort();
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include "buffer_pool.h"
+#include "file_cache.h"
+#include "file_prefetcher.h"
+#include "group_committer.h"
+#include "listing_cache.h"
+#include "server_settings.h"
+#include "token_bucket.h"
+#include "transfer_scheduler.h"
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+  #include <file_io_uring.h>
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+namespace fineftp
+{
+  /**
+   * @brief State and services shared by all sessions of an FtpServer
+   *
+   * The context is owned by the server implementation and outlives all of its
+   * sessions. The settings are not modified while the server is running.
+   */
+  struct ServerContext
+  {
+    ServerSettings settings;
+
+    /** Bandwidth limit shared by all transfers. nullptr, if the bandwidth is not limited. */
+    std::unique_ptr<TokenBucket> bandwidth_limit;
+
+    /** Distributes the worker threads fairly among the transfers of all sessions */
+    std::unique_ptr<TransferScheduler> transfer_scheduler;
+
+    /** Recently downloaded files */
+    std::unique_ptr<FileCache> file_cache;
+
+    /** Formatted listings of recently listed directories */
+    std::unique_ptr<ListingCache> listing_cache;
+
+    /** Reads files into the page cache, so the io threads don't block on disk reads */
+    std::unique_ptr<FilePrefetcher> file_prefetcher;
+
+    /** Buffers that uploads are received into and directory listings are created in */
+    std::unique_ptr<BufferPool> receive_buffer_pool;
+
+    /** Threads that write uploaded data to the disk, so the io threads don't block on disk writes */
+    std::unique_ptr<asio::thread_pool> disk_writer_pool;
+
+    /** Threads that read directories and stat their entries in parallel, so the io threads don't block on the disk */
+    std::unique_ptr<asio::thread_pool> directory_listing_pool;
+
+    /** Commits uploaded files in batches. nullptr, unless DurabilityPolicy::GroupCommit is used. */
+    std::unique_ptr<GroupCommitter> group_committer;
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    /** Ring for asynchronous file I/O. nullptr, if io_uring is not available. */
+    std::unique_ptr<FileIoUring> io_uring;
+#endif // FINEFTP_SERVER_USE_IO_URING
+  };
+}
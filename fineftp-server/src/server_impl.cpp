@@ -9,12 +9,31 @@
 #include <cstdint>
 #include <cstddef>
 
+#include <fineftp/durability.h>
 #include <fineftp/permissions.h>
+#include <fineftp/user_settings.h>
+
+#include "token_bucket.h"
 
 #include <asio.hpp> // IWYU pragma: keep
 
 namespace fineftp
 {
+  namespace
+  {
+    constexpr std::size_t file_prefetcher_thread_count = 2;
+    constexpr std::size_t disk_writer_thread_count     = 4;
+    constexpr std::size_t max_free_receive_buffer_bytes = 64 * 1024 * 1024;
+  }  // namespace
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+  namespace
+  {
+    constexpr unsigned int io_uring_queue_depth  = 128;
+    constexpr std::size_t  io_uring_buffer_count = 16;
+    constexpr std::size_t  io_uring_buffer_size  = 1024 * 1024;
+  }  // namespace
+#endif // FINEFTP_SERVER_USE_IO_URING
 
   FtpServerImpl::FtpServerImpl(const std::string& address, const uint16_t port, std::ostream& output, std::ostream& error)
     : ftp_users_            (output, error)
@@ -31,19 +50,136 @@ namespace fineftp
     stop();
   }
 
-  bool FtpServerImpl::addUser(const std::string& username, const std::string& password, const std::string& local_root_path, const Permission permissions)
+  bool FtpServerImpl::addUser(const std::string& username, const std::string& password, const std::string& local_root_path, const Permission permissions, const UserSettings& settings)
+  {
+    return ftp_users_.addUser(username, password, local_root_path, permissions, settings);
+  }
+
+  bool FtpServerImpl::addUserAnonymous(const std::string& local_root_path, const Permission permissions, const UserSettings& settings)
+  {
+    return ftp_users_.addUser("anonymous", "", local_root_path, permissions, settings);
+  }
+
+  void FtpServerImpl::setFileWindowSize(std::size_t window_size)
+  {
+    server_context_.settings.file_window_size = window_size;
+  }
+
+  void FtpServerImpl::setMaxBytesPerSecond(std::size_t bytes_per_second)
+  {
+    server_context_.settings.max_bytes_per_second = bytes_per_second;
+  }
+
+  void FtpServerImpl::setTransferQuantumSize(std::size_t quantum_size)
+  {
+    server_context_.settings.transfer_quantum_size = quantum_size;
+  }
+
+  void FtpServerImpl::setColdStreamingThreshold(std::size_t file_size)
+  {
+    server_context_.settings.cold_streaming_threshold = file_size;
+  }
+
+  void FtpServerImpl::setDurabilityPolicy(DurabilityPolicy policy)
   {
-    return ftp_users_.addUser(username, password, local_root_path, permissions);
+    server_context_.settings.durability_policy = policy;
   }
 
-  bool FtpServerImpl::addUserAnonymous(const std::string& local_root_path, const Permission permissions)
+  void FtpServerImpl::setReceiveBufferSizeLimits(std::size_t min_size, std::size_t max_size)
   {
-    return ftp_users_.addUser("anonymous", "", local_root_path, permissions);
+    server_context_.settings.min_receive_buffer_size = min_size;
+    server_context_.settings.max_receive_buffer_size = max_size;
+  }
+
+  void FtpServerImpl::setAtomicUploads(bool enable)
+  {
+    server_context_.settings.atomic_uploads = enable;
+  }
+
+  void FtpServerImpl::setDirectoryListingCacheLimits(std::size_t max_bytes, std::size_t max_directories)
+  {
+    server_context_.settings.listing_cache_max_bytes       = max_bytes;
+    server_context_.settings.listing_cache_max_directories = max_directories;
+  }
+
+  void FtpServerImpl::setDirectoryListingThreadCount(std::size_t thread_count)
+  {
+    server_context_.settings.directory_listing_thread_count = thread_count;
+  }
+
+  void FtpServerImpl::setFileCacheLimits(std::size_t max_total_file_size, std::size_t max_entries)
+  {
+    server_context_.settings.file_cache_max_total_file_size = max_total_file_size;
+    server_context_.settings.file_cache_max_entries         = max_entries;
   }
 
   bool FtpServerImpl::start(size_t thread_count)
   {
-    auto ftp_session = std::make_shared<FtpSession>(io_context_, ftp_users_, [this]() { open_connection_count_--; }, output_, error_);
+    if ((server_context_.settings.max_bytes_per_second > 0) && !server_context_.bandwidth_limit)
+    {
+      server_context_.bandwidth_limit = std::make_unique<TokenBucket>(server_context_.settings.max_bytes_per_second);
+    }
+
+    if (!server_context_.transfer_scheduler)
+    {
+      // One quantum less than there are threads, so there is always a thread
+      // left for the command connections. With a single thread, transfers
+      // and commands have to share it.
+      const std::size_t max_active_quanta = ((thread_count > 1) ? (thread_count - 1) : 1);
+      server_context_.transfer_scheduler = std::make_unique<TransferScheduler>(max_active_quanta, server_context_.settings.transfer_quantum_size);
+    }
+
+    if (!server_context_.file_cache)
+    {
+      server_context_.file_cache = std::make_unique<FileCache>(server_context_.settings.file_cache_max_total_file_size, server_context_.settings.file_cache_max_entries);
+    }
+
+    if (!server_context_.listing_cache)
+    {
+      server_context_.listing_cache = std::make_unique<ListingCache>(server_context_.settings.listing_cache_max_bytes, server_context_.settings.listing_cache_max_directories);
+    }
+
+    if (!server_context_.receive_buffer_pool)
+    {
+      server_context_.receive_buffer_pool = std::make_unique<BufferPool>(max_free_receive_buffer_bytes);
+    }
+
+    if (!server_context_.disk_writer_pool)
+    {
+      server_context_.disk_writer_pool = std::make_unique<asio::thread_pool>(disk_writer_thread_count);
+    }
+
+    if (!server_context_.directory_listing_pool)
+    {
+      server_context_.directory_listing_pool = std::make_unique<asio::thread_pool>(server_context_.settings.directory_listing_thread_count);
+    }
+
+    if (!server_context_.group_committer && (server_context_.settings.durability_policy == DurabilityPolicy::GroupCommit))
+    {
+      server_context_.group_committer = std::make_unique<GroupCommitter>();
+    }
+
+    if (!server_context_.file_prefetcher)
+    {
+      server_context_.file_prefetcher = std::make_unique<FilePrefetcher>(file_prefetcher_thread_count, server_context_.settings.file_prefetch_size);
+    }
+
+#ifdef FINEFTP_SERVER_USE_IO_URING
+    if (!server_context_.io_uring)
+    {
+      server_context_.io_uring = std::make_unique<FileIoUring>(io_context_, io_uring_queue_depth, io_uring_buffer_count, io_uring_buffer_size);
+      if (!server_context_.io_uring->isOk())
+      {
+#ifndef NDEBUG
+        output_ << "io_uring is not available. Falling back to synchronous file I/O." << std::endl;
+#endif // NDEBUG
+        server_context_.io_uring.reset();
+      }
+      server_context_.file_prefetcher->setIoUring(server_context_.io_uring.get());
+    }
+#endif // FINEFTP_SERVER_USE_IO_URING
+
+    auto ftp_session = std::make_shared<FtpSession>(io_context_, ftp_users_, server_context_, [this]() { open_connection_count_--; }, output_, error_);
 
     // set up the acceptor to listen on the tcp port
     asio::error_code make_address_ec;
@@ -140,7 +276,7 @@ namespace fineftp
 
     ftp_session->start();
 
-    auto new_session = std::make_shared<FtpSession>(io_context_, ftp_users_, [this]() { open_connection_count_--; }, output_, error_);
+    auto new_session = std::make_shared<FtpSession>(io_context_, ftp_users_, server_context_, [this]() { open_connection_count_--; }, output_, error_);
 
     acceptor_.async_accept(new_session->getSocket()
                           , [this, new_session](auto ec)
@@ -155,6 +291,36 @@ namespace fineftp
     return open_connection_count_;
   }
 
+  std::uint64_t FtpServerImpl::getFileCacheHitCount()
+  {
+    return (server_context_.file_cache ? server_context_.file_cache->hitCount() : 0);
+  }
+
+  std::uint64_t FtpServerImpl::getFileCacheMissCount()
+  {
+    return (server_context_.file_cache ? server_context_.file_cache->missCount() : 0);
+  }
+
+  std::uint64_t FtpServerImpl::getDirectoryListingCacheHitCount()
+  {
+    return (server_context_.listing_cache ? server_context_.listing_cache->hitCount() : 0);
+  }
+
+  std::uint64_t FtpServerImpl::getDirectoryListingCacheMissCount()
+  {
+    return (server_context_.listing_cache ? server_context_.listing_cache->missCount() : 0);
+  }
+
+  std::size_t FtpServerImpl::getReceiveBuffersInUseCount()
+  {
+    return (server_context_.receive_buffer_pool ? server_context_.receive_buffer_pool->inUseCount() : 0);
+  }
+
+  std::size_t FtpServerImpl::getReceiveBuffersAllocatedCount()
+  {
+    return (server_context_.receive_buffer_pool ? server_context_.receive_buffer_pool->allocatedCount() : 0);
+  }
+
   uint16_t FtpServerImpl::getPort()
   {
     return acceptor_.local_endpoint().port();
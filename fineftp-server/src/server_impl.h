@@ -10,8 +10,11 @@
 
 #include <asio.hpp> // IWYU pragma: keep
 
+#include <fineftp/durability.h>
 #include <fineftp/permissions.h>
+#include <fineftp/user_settings.h>
 #include <ftp_session.h>
+#include <server_context.h>
 
 #include <user_database.h>
 
@@ -32,8 +35,24 @@ namespace fineftp
 
     ~FtpServerImpl();
 
-    bool addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions);
-    bool addUserAnonymous(const std::string& local_root_path, Permission permissions);
+    bool addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions, const UserSettings& settings = UserSettings());
+    bool addUserAnonymous(const std::string& local_root_path, Permission permissions, const UserSettings& settings = UserSettings());
+
+    void setFileWindowSize(std::size_t window_size);
+    void setMaxBytesPerSecond(std::size_t bytes_per_second);
+    void setTransferQuantumSize(std::size_t quantum_size);
+    void setFileCacheLimits(std::size_t max_total_file_size, std::size_t max_entries);
+    void setColdStreamingThreshold(std::size_t file_size);
+
+    void setDurabilityPolicy(DurabilityPolicy policy);
+
+    void setAtomicUploads(bool enable);
+
+    void setReceiveBufferSizeLimits(std::size_t min_size, std::size_t max_size);
+
+    void setDirectoryListingThreadCount(std::size_t thread_count);
+
+    void setDirectoryListingCacheLimits(std::size_t max_bytes, std::size_t max_directories);
 
     bool start(size_t thread_count = 1);
 
@@ -41,6 +60,15 @@ namespace fineftp
 
     int getOpenConnectionCount();
 
+    std::uint64_t getFileCacheHitCount();
+    std::uint64_t getFileCacheMissCount();
+
+    std::uint64_t getDirectoryListingCacheHitCount();
+    std::uint64_t getDirectoryListingCacheMissCount();
+
+    std::size_t getReceiveBuffersInUseCount();
+    std::size_t getReceiveBuffersAllocatedCount();
+
     uint16_t getPort(); 
 
     std::string getAddress();
@@ -58,6 +86,10 @@ namespace fineftp
     asio::io_context         io_context_;
     asio::ip::tcp::acceptor  acceptor_;
 
+    // Declared after the io_context, as the context may hold I/O objects
+    // that have to be destroyed before the io_context.
+    ServerContext            server_context_;
+
     std::atomic<int> open_connection_count_;
 
     std::ostream& output_;  /* Normal output log */
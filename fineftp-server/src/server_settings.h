@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+
+#include <fineftp/durability.h>
+
+namespace fineftp
+{
+  /**
+   * @brief Tuning parameters shared by all sessions of an FtpServer
+   *
+   * The settings are configured through the FtpServer API before the server
+   * is started and are not modified while the server is running.
+   */
+  struct ServerSettings
+  {
+    /** Size of the file segments that are mapped into memory at once when sending a file */
+    std::size_t file_window_size = 16 * 1024 * 1024;
+
+    /** Maximum bandwidth of all transfers combined in bytes per second. 0 means unlimited. */
+    std::size_t max_bytes_per_second = 0;
+
+    /** Number of bytes a transfer may send or receive before other transfers get their turn */
+    std::size_t transfer_quantum_size = 256 * 1024;
+
+    /** Minimum number of bytes that an upload reads from the data socket at once */
+    std::size_t min_receive_buffer_size = 64 * 1024;
+
+    /** Maximum number of bytes that an upload reads from the data socket at once */
+    std::size_t max_receive_buffer_size = 4 * 1024 * 1024;
+
+    /** The read size of uploads is not shrunk below what their receive rate delivers in this duration */
+    std::chrono::milliseconds receive_buffer_target_duration = std::chrono::milliseconds(10);
+
+    /** Number of threads that stat the entries of directory listings in parallel */
+    std::size_t directory_listing_thread_count = 4;
+
+    /** Maximum number of received buffers of an upload that may wait for being written to the disk */
+    std::size_t max_file_writes_in_flight = 4;
+
+    /** Number of bytes that are read into the page cache at once by the FilePrefetcher */
+    std::size_t file_prefetch_size = 2 * 1024 * 1024;
+
+    /** Files of at least this size are dropped from the page cache once they have been sent. 0 means never. */
+    std::size_t cold_streaming_threshold = 0;
+
+    /** Cold streamed files are dropped from the page cache in blocks of this size, one block behind the send cursor */
+    std::size_t cold_streaming_block_size = 4 * 1024 * 1024;
+
+    /** Maximum sum of the sizes of the files that are kept open after their last download. 0 disables the cache. */
+    std::size_t file_cache_max_total_file_size = 0;
+
+    /** Maximum number of files that are kept open after their last download */
+    std::size_t file_cache_max_entries = 0;
+
+    /** Maximum sum of the sizes of the cached directory listings. 0 disables the cache. */
+    std::size_t listing_cache_max_bytes = 0;
+
+    /** Maximum number of directories whose listings are cached */
+    std::size_t listing_cache_max_directories = 0;
+
+    /** When the data of uploads is flushed to the disk before replying with 226 */
+    DurabilityPolicy durability_policy = DurabilityPolicy::None;
+
+    /** Whether STOR and STOU write to a temporary file that replaces the target once the upload is complete */
+    bool atomic_uploads = false;
+  };
+}
@@ -0,0 +1,55 @@
+#include "token_bucket.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace fineftp
+{
+  namespace
+  {
+    constexpr std::size_t min_chunk_size = 4 * 1024;
+    constexpr std::size_t max_chunk_size = 1024 * 1024;
+  }  // namespace
+
+  TokenBucket::TokenBucket(std::size_t bytes_per_second)
+    : bytes_per_second_(static_cast<double>(bytes_per_second))
+    , capacity_        (static_cast<double>(bytes_per_second) / 10.0)
+    , tokens_          (capacity_)
+    , last_refill_     (std::chrono::steady_clock::now())
+  {}
+
+  std::chrono::steady_clock::duration TokenBucket::delay()
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    refill(std::chrono::steady_clock::now());
+
+    if (tokens_ >= 0.0)
+    {
+      return std::chrono::steady_clock::duration::zero();
+    }
+
+    const std::chrono::duration<double> seconds_to_pay_off(-tokens_ / bytes_per_second_);
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(seconds_to_pay_off) + std::chrono::steady_clock::duration(1);
+  }
+
+  void TokenBucket::consume(std::size_t bytes)
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    refill(std::chrono::steady_clock::now());
+    tokens_ -= static_cast<double>(bytes);
+  }
+
+  std::size_t TokenBucket::chunkSize() const
+  {
+    return std::min(max_chunk_size, std::max(min_chunk_size, static_cast<std::size_t>(capacity_)));
+  }
+
+  void TokenBucket::refill(std::chrono::steady_clock::time_point now)
+  {
+    const std::chrono::duration<double> elapsed = now - last_refill_;
+    last_refill_ = now;
+    tokens_      = std::min(capacity_, tokens_ + (elapsed.count() * bytes_per_second_));
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace fineftp
+{
+  /**
+   * @brief A token bucket for limiting the bandwidth of transfers
+   *
+   * The bucket is refilled with the configured number of bytes per second
+   * and holds at most the tokens for 100 ms of traffic. Transfers take the
+   * tokens for each chunk they send or receive. Taking more tokens than
+   * available puts the bucket into debt, which has to be paid off before the
+   * next chunk may be transferred. Thus, transfers never block a thread.
+   * They ask for the delay() and wait for it with a timer instead.
+   *
+   * The bucket may be shared by multiple transfers. It is thread safe.
+   */
+  class TokenBucket
+  {
+  public:
+    explicit TokenBucket(std::size_t bytes_per_second);
+
+    // Copy / Move disabled
+    TokenBucket(const TokenBucket&)            = delete;
+    TokenBucket& operator=(const TokenBucket&) = delete;
+    TokenBucket(TokenBucket&&)                 = delete;
+    TokenBucket& operator=(TokenBucket&&)      = delete;
+
+    ~TokenBucket() = default;
+
+    /** @brief Returns the time to wait until the next chunk may be transferred (0, if it may be transferred right now) */
+    std::chrono::steady_clock::duration delay();
+
+    /** @brief Takes the tokens for the given number of bytes out of the bucket */
+    void consume(std::size_t bytes);
+
+    /** @brief Returns a chunk size that lets the bucket spread the bandwidth evenly across its transfers */
+    std::size_t chunkSize() const;
+
+  private:
+    void refill(std::chrono::steady_clock::time_point now);
+
+  private:
+    const double bytes_per_second_;
+    const double capacity_;
+
+    std::mutex                            mutex_;
+    double                                tokens_;
+    std::chrono::steady_clock::time_point last_refill_;
+  };
+}
@@ -0,0 +1,73 @@
+#include "transfer_scheduler.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+namespace fineftp
+{
+  TransferScheduler::TransferScheduler(std::size_t max_active_quanta, std::size_t quantum_size)
+    : max_active_quanta_(max_active_quanta)
+    , quantum_size_     (quantum_size)
+    , active_quanta_    (0)
+  {}
+
+  void TransferScheduler::request(Flow& flow, unsigned int weight, const GrantHandler& handler)
+  {
+    std::size_t quantum = 0;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      if (active_quanta_ >= max_active_quanta_)
+      {
+        flow.requests_.push_back(Request{weight, handler});
+        if (flow.requests_.size() == 1)
+          active_flows_.push_back(&flow);
+        return;
+      }
+      ++active_quanta_;
+      quantum = grant(flow, weight);
+    }
+
+    handler(quantum);
+  }
+
+  void TransferScheduler::release(Flow& flow, std::size_t bytes_moved)
+  {
+    Request     next;
+    std::size_t quantum = 0;
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      flow.deficit_ = flow.granted_ - (std::min)(bytes_moved, flow.granted_);
+      flow.granted_ = 0;
+
+      if (active_flows_.empty())
+      {
+        --active_quanta_;
+        return;
+      }
+
+      // The quantum is passed on to the next flow in line. If the flow has
+      // more requests waiting, it queues up again at the end of the round.
+      Flow* next_flow = active_flows_.front();
+      active_flows_.pop_front();
+
+      next = std::move(next_flow->requests_.front());
+      next_flow->requests_.pop_front();
+      if (!next_flow->requests_.empty())
+        active_flows_.push_back(next_flow);
+
+      quantum = grant(*next_flow, next.weight);
+    }
+
+    next.handler(quantum);
+  }
+
+  std::size_t TransferScheduler::grant(Flow& flow, unsigned int weight)
+  {
+    const std::size_t weighted_quantum = quantum_size_ * weight;
+    flow.granted_ = (std::min)(flow.deficit_, weighted_quantum) + weighted_quantum;
+    flow.deficit_ = 0;
+    return flow.granted_;
+  }
+}
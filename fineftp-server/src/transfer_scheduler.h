@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace fineftp
+{
+  /**
+   * @brief Shares the data transfers of all sessions fairly
+   *
+   * Transfers don't move their data in one go. Instead, they ask the
+   * scheduler for a quantum and move at most that many bytes before they
+   * release the quantum and ask for the next one. Only a limited number of
+   * quanta is active at a time.
+   *
+   * The waiting transfers are served by deficit round robin. Each session
+   * owns a Flow with its own queue of requests and its own deficit. The
+   * flows that have waiting requests take turns. On its turn, a flow's
+   * deficit is increased by the quantum times its weight, and the flow may
+   * move up to its deficit. Whatever it does not move (e.g. because the
+   * socket would block) is kept for the next turn, so a transfer that could
+   * not use its turn catches up later. The carried deficit is limited to
+   * one weighted quantum, so an idle flow cannot save up a burst. Each flow
+   * gets a share of the bandwidth proportional to its weight, and a new
+   * transfer only waits for one round, no matter how large the other
+   * transfers are.
+   *
+   * Transfers must only ask for a quantum when they are able to transfer
+   * data right away (e.g. when the socket is writable), so a slow client
+   * never occupies a quantum.
+   *
+   * The scheduler is thread safe.
+   */
+  class TransferScheduler
+  {
+  public:
+    /** Called when the transfer may move the given number of bytes. Must not block. */
+    using GrantHandler = std::function<void(std::size_t quantum)>;
+
+  private:
+    struct Request
+    {
+      unsigned int weight = 1;
+      GrantHandler handler;
+    };
+
+  public:
+    /**
+     * @brief The scheduling state of one session
+     *
+     * Must outlive all of its waiting requests. Sessions guarantee that by
+     * keeping themselves alive in their grant handlers.
+     */
+    class Flow
+    {
+    private:
+      friend class TransferScheduler;
+
+      std::size_t         deficit_ = 0;   ///< Bytes left over from previous turns
+      std::size_t         granted_ = 0;   ///< Bytes granted with the active quantum
+      std::deque<Request> requests_;      ///< Requests waiting for their turn
+    };
+
+    /**
+     * @param max_active_quanta   Number of quanta that may be active at the same time.
+     * @param quantum_size        Size of a quantum of a transfer with weight 1.
+     */
+    TransferScheduler(std::size_t max_active_quanta, std::size_t quantum_size);
+
+    // Copy / Move disabled
+    TransferScheduler(const TransferScheduler&)            = delete;
+    TransferScheduler& operator=(const TransferScheduler&) = delete;
+    TransferScheduler(TransferScheduler&&)                 = delete;
+    TransferScheduler& operator=(TransferScheduler&&)      = delete;
+
+    ~TransferScheduler() = default;
+
+    /**
+     * @brief Asks for a quantum
+     *
+     * The handler is called right away if a quantum is available, otherwise
+     * it is called from release() once it is the flow's turn. Each call of
+     * the handler has to be answered with a call to release().
+     *
+     * @param flow      The flow of the session that asks.
+     * @param weight    The weight of the transfer. Must not be 0.
+     * @param handler   The handler that is called with the quantum.
+     */
+    void request(Flow& flow, unsigned int weight, const GrantHandler& handler);
+
+    /**
+     * @brief Returns a quantum after the transfer has moved its data
+     *
+     * @param flow          The flow that the quantum has been granted to.
+     * @param bytes_moved   The number of bytes the transfer has moved. The rest of the quantum is kept as the flow's deficit.
+     */
+    void release(Flow& flow, std::size_t bytes_moved);
+
+  private:
+    std::size_t grant(Flow& flow, unsigned int weight);
+
+  private:
+    const std::size_t   max_active_quanta_;
+    const std::size_t   quantum_size_;
+
+    std::mutex          mutex_;
+    std::size_t         active_quanta_;
+    std::deque<Flow*>   active_flows_;    ///< Flows with waiting requests in round robin order
+  };
+}
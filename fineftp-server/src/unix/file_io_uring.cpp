@@ -0,0 +1,426 @@
+/// @file
+
+#include "file_io_uring.h"
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Older C library headers may not know the io_uring system calls, yet
+#ifndef __NR_io_uring_setup
+  #define __NR_io_uring_setup    425
+#endif
+#ifndef __NR_io_uring_enter
+  #define __NR_io_uring_enter    426
+#endif
+#ifndef __NR_io_uring_register
+  #define __NR_io_uring_register 427
+#endif
+
+namespace fineftp
+{
+
+  namespace
+  {
+    int ioUringSetup(unsigned int entries, io_uring_params* params)
+    {
+      return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+    {
+      return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    int ioUringRegister(int ring_fd, unsigned int opcode, const void* arg, unsigned int nr_args)
+    {
+      return static_cast<int>(::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+    }
+
+    template <typename T>
+    T* ringPointer(void* ring, std::uint32_t offset)
+    {
+      return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+  }  // namespace
+
+  struct FileIoUring::BufferSlab
+  {
+    std::mutex                     mutex;
+    std::vector<std::vector<char>> buffers;
+    std::vector<std::size_t>       free_indices;
+  };
+
+  FileIoUring::FileIoUring(asio::io_context& io_context, unsigned int queue_depth, std::size_t buffer_count, std::size_t buffer_size)
+    : buffer_slab_    (std::make_shared<BufferSlab>())
+    , event_descriptor_(io_context)
+  {
+    // Allocate the buffers. They are also used if registering them fails.
+    buffer_slab_->buffers.resize(buffer_count);
+    for (std::size_t i = 0; i < buffer_count; ++i)
+    {
+      buffer_slab_->buffers[i].resize(buffer_size);
+      buffer_slab_->free_indices.push_back(buffer_count - 1 - i);
+    }
+
+    io_uring_params params{};
+    ring_fd_ = ioUringSetup(queue_depth, &params);
+    if (ring_fd_ < 0)
+    {
+      ring_fd_ = -1;
+      return;
+    }
+
+    // Map the submission and completion queues. Newer kernels allow mapping
+    // both with a single mmap call.
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_ring_size_ = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = ((params.features & IORING_FEAT_SINGLE_MMAP) != 0);
+    if (single_mmap)
+    {
+      sq_ring_size_ = (std::max)(sq_ring_size_, cq_ring_size_);
+      cq_ring_size_ = sq_ring_size_;
+    }
+
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED)
+    {
+      sq_ring_ = nullptr;
+      teardown();
+      return;
+    }
+
+    if (single_mmap)
+    {
+      cq_ring_ = sq_ring_;
+    }
+    else
+    {
+      cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED)
+      {
+        cq_ring_ = nullptr;
+        teardown();
+        return;
+      }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+      teardown();
+      return;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    sq_head_    = ringPointer<unsigned int>(sq_ring_, params.sq_off.head);
+    sq_tail_    = ringPointer<unsigned int>(sq_ring_, params.sq_off.tail);
+    sq_mask_    = ringPointer<unsigned int>(sq_ring_, params.sq_off.ring_mask);
+    sq_array_   = ringPointer<unsigned int>(sq_ring_, params.sq_off.array);
+    sq_entries_ = params.sq_entries;
+
+    cq_head_    = ringPointer<unsigned int>(cq_ring_, params.cq_off.head);
+    cq_tail_    = ringPointer<unsigned int>(cq_ring_, params.cq_off.tail);
+    cq_mask_    = ringPointer<unsigned int>(cq_ring_, params.cq_off.ring_mask);
+    cqes_       = ringPointer<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+    cq_entries_ = params.cq_entries;
+
+    // Let the kernel signal completions through an eventfd that asio can wait for
+    event_fd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if ((event_fd_ == -1) || (ioUringRegister(ring_fd_, IORING_REGISTER_EVENTFD, &event_fd_, 1) != 0))
+    {
+      teardown();
+      return;
+    }
+
+    {
+      asio::error_code ec;
+      event_descriptor_.assign(event_fd_, ec);
+      if (ec)
+      {
+        teardown();
+        return;
+      }
+    }
+
+    // Register the buffers. This may fail, e.g. if the amount of memory we are
+    // allowed to lock is exceeded. In that case the buffers are used for
+    // ordinary reads and writes.
+    if (buffer_count > 0)
+    {
+      std::vector<iovec> iovecs(buffer_count);
+      for (std::size_t i = 0; i < buffer_count; ++i)
+      {
+        iovecs[i].iov_base = buffer_slab_->buffers[i].data();
+        iovecs[i].iov_len  = buffer_slab_->buffers[i].size();
+      }
+      buffers_registered_ = (ioUringRegister(ring_fd_, IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned int>(iovecs.size())) == 0);
+    }
+
+    waitForCompletions();
+  }
+
+  FileIoUring::~FileIoUring()
+  {
+    if (ring_fd_ == -1)
+    {
+      return;
+    }
+
+    // The kernel may still be accessing our buffers. Wait for all requests
+    // to complete before releasing the memory.
+    for (;;)
+    {
+      {
+        const std::lock_guard<std::mutex> lock(submission_mutex_);
+        if ((requests_in_flight_ == 0) && backlog_.empty())
+          break;
+      }
+      enter(1);
+      reapCompletions();
+    }
+
+    teardown();
+  }
+
+  void FileIoUring::teardown()
+  {
+    {
+      asio::error_code ec;
+      event_descriptor_.close(ec);  // Also closes the eventfd, if it has been assigned
+    }
+    if ((event_fd_ != -1) && !event_descriptor_.is_open())
+    {
+      ::close(event_fd_);
+    }
+    event_fd_ = -1;
+
+    if (sqes_ != nullptr)
+      ::munmap(sqes_, sqes_size_);
+    if ((cq_ring_ != nullptr) && (cq_ring_ != sq_ring_))
+      ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != nullptr)
+      ::munmap(sq_ring_, sq_ring_size_);
+
+    sqes_    = nullptr;
+    cq_ring_ = nullptr;
+    sq_ring_ = nullptr;
+
+    if (ring_fd_ != -1)
+      ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+
+  std::shared_ptr<std::vector<char>> FileIoUring::acquireBuffer()
+  {
+    const std::lock_guard<std::mutex> lock(buffer_slab_->mutex);
+    if (buffer_slab_->free_indices.empty())
+    {
+      return nullptr;
+    }
+
+    const std::size_t index = buffer_slab_->free_indices.back();
+    buffer_slab_->free_indices.pop_back();
+
+    std::vector<char>* buffer = &buffer_slab_->buffers[index];
+    buffer->resize(buffer->capacity());
+
+    // The deleter returns the buffer to the slab. It keeps the slab alive, so
+    // the buffer may even outlive the ring.
+    return std::shared_ptr<std::vector<char>>(buffer, [slab = buffer_slab_, index](std::vector<char>* /*buffer*/)
+                                                      {
+                                                        const std::lock_guard<std::mutex> lock(slab->mutex);
+                                                        slab->free_indices.push_back(index);
+                                                      });
+  }
+
+  void FileIoUring::asyncRead(int fd, const std::shared_ptr<std::vector<char>>& buffer, std::uint64_t offset, const CompletionHandler& handler)
+  {
+    submit(std::unique_ptr<Request>(new Request{false, fd, buffer, offset, 0, handler}));
+  }
+
+  void FileIoUring::asyncWrite(int fd, const std::shared_ptr<std::vector<char>>& buffer, std::uint64_t offset, const CompletionHandler& handler)
+  {
+    submit(std::unique_ptr<Request>(new Request{true, fd, buffer, offset, 0, handler}));
+  }
+
+  void FileIoUring::submit(std::unique_ptr<Request> request)
+  {
+    {
+      const std::lock_guard<std::mutex> lock(submission_mutex_);
+
+      // Keep the order of the requests. If there are requests waiting for
+      // room in the submission or completion queue, the new one has to wait, too.
+      if (!backlog_.empty() || !pushSubmission(request.get()))
+      {
+        backlog_.push_back(std::move(request));
+        return;
+      }
+      (void)request.release(); // The request is now owned by the kernel and freed on completion
+    }
+
+    enter(0);
+  }
+
+  bool FileIoUring::pushSubmission(Request* request)
+  {
+    // Each request in flight will post one completion. The completion queue
+    // must be able to hold all of them, as kernels without IORING_FEAT_NODROP
+    // silently drop completions that do not fit. Those requests would never
+    // be completed and their memory would leak.
+    if (requests_in_flight_ >= cq_entries_)
+    {
+      return false;
+    }
+
+    const unsigned int head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    const unsigned int tail = *sq_tail_;
+    if ((tail - head) >= sq_entries_)
+    {
+      return false;
+    }
+
+    const unsigned int index = tail & *sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+
+    const int buffer_index = registeredBufferIndex(request->buffer.get());
+    if (request->is_write)
+      sqe->opcode = ((buffer_index >= 0) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE);
+    else
+      sqe->opcode = ((buffer_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ);
+
+    sqe->fd        = request->fd;
+    sqe->off       = request->offset + request->done;
+    sqe->addr      = reinterpret_cast<std::uint64_t>(request->buffer->data() + request->done);
+    sqe->len       = static_cast<std::uint32_t>(request->buffer->size() - request->done);
+    sqe->user_data = reinterpret_cast<std::uint64_t>(request);
+    if (buffer_index >= 0)
+      sqe->buf_index = static_cast<std::uint16_t>(buffer_index);
+
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+    ++requests_in_flight_;
+    return true;
+  }
+
+  void FileIoUring::enter(unsigned int min_complete)
+  {
+    // Submit everything the kernel hasn't consumed from the submission queue, yet
+    unsigned int to_submit = 0;
+    {
+      const std::lock_guard<std::mutex> lock(submission_mutex_);
+      to_submit = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    }
+
+    const unsigned int flags = ((min_complete > 0) ? IORING_ENTER_GETEVENTS : 0U);
+    while ((ioUringEnter(ring_fd_, to_submit, min_complete, flags) < 0) && (errno == EINTR))
+    {}
+  }
+
+  void FileIoUring::waitForCompletions()
+  {
+    event_descriptor_.async_read_some(asio::buffer(&event_count_, sizeof(event_count_))
+                                    , [this](asio::error_code ec, std::size_t /*length*/)
+                                      {
+                                        if (ec == asio::error::operation_aborted)
+                                        {
+                                          return;
+                                        }
+
+                                        reapCompletions();
+                                        waitForCompletions();
+                                      });
+  }
+
+  void FileIoUring::reapCompletions()
+  {
+    std::vector<std::pair<std::unique_ptr<Request>, int>> completed;
+
+    unsigned int       head = *cq_head_;
+    const unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+      const io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+      completed.emplace_back(std::unique_ptr<Request>(reinterpret_cast<Request*>(cqe->user_data)), cqe->res); // NOLINT(performance-no-int-to-ptr) Reason: The kernel hands back the pointer we gave it
+      ++head;
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    if (completed.empty())
+    {
+      return;
+    }
+
+    {
+      const std::lock_guard<std::mutex> lock(submission_mutex_);
+      requests_in_flight_ -= completed.size();
+    }
+
+    for (auto& completion : completed)
+    {
+      std::unique_ptr<Request>& request = completion.first;
+      const int                 result  = completion.second;
+
+      // Writes to regular files may complete partially. Submit the rest.
+      if (request->is_write && (result > 0) && (request->done + static_cast<std::size_t>(result) < request->buffer->size()))
+      {
+        request->done += static_cast<std::size_t>(result);
+        submit(std::move(request));
+        continue;
+      }
+
+      request->handler((result < 0) ? result : static_cast<int>(request->done + static_cast<std::size_t>(result)));
+    }
+
+    // Move waiting requests to the submission queue, as there is room now
+    bool submitted_backlog = false;
+    {
+      const std::lock_guard<std::mutex> lock(submission_mutex_);
+      while (!backlog_.empty() && pushSubmission(backlog_.front().get()))
+      {
+        (void)backlog_.front().release();
+        backlog_.pop_front();
+        submitted_backlog = true;
+      }
+    }
+    if (submitted_backlog)
+    {
+      enter(0);
+    }
+  }
+
+  int FileIoUring::registeredBufferIndex(const std::vector<char>* buffer) const
+  {
+    if (!buffers_registered_ || buffer_slab_->buffers.empty())
+    {
+      return -1;
+    }
+
+    const std::vector<char>* first = buffer_slab_->buffers.data();
+    const std::vector<char>* last  = first + buffer_slab_->buffers.size();
+    if ((buffer < first) || (buffer >= last))
+    {
+      return -1;
+    }
+
+    return static_cast<int>(buffer - first);
+  }
+}
@@ -0,0 +1,154 @@
+/// @file
+
+#ifndef FINEFTP_SERVER_SRC_UNIX_FILE_IO_URING_H_
+#define FINEFTP_SERVER_SRC_UNIX_FILE_IO_URING_H_
+
+#include <asio.hpp> // IWYU pragma: keep
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace fineftp
+{
+
+/// Asynchronous file I/O through a Linux io_uring instance.
+///
+/// Reads and writes are submitted to the kernel and complete without blocking
+/// any thread. Completions are signalled through an eventfd that is watched by
+/// the given asio io_context, so completion handlers are executed by the
+/// threads running that io_context. Handlers that need to be serialized must
+/// be wrapped in a strand by the caller.
+///
+/// The ring owns a slab of buffers that are registered with the kernel. I/O on
+/// those buffers avoids mapping the user pages for each request.
+///
+/// The ring talks to the kernel through the raw system calls, so no additional
+/// library is required. Linux 5.6 or newer is required for the read / write
+/// operations. If the kernel does not support io_uring, isOk() returns false.
+///
+/// @note The implementation is thread safe.
+class FileIoUring
+{
+public:
+  /// Completion handler. The parameter is the number of bytes transferred or
+  /// a negative errno value.
+  using CompletionHandler = std::function<void(int result)>;
+
+  /// @brief Constructor.
+  ///
+  /// @param io_context    The io_context that dispatches the completions.
+  /// @param queue_depth   The number of submission queue entries.
+  /// @param buffer_count  The number of registered buffers.
+  /// @param buffer_size   The size of each registered buffer.
+  FileIoUring(asio::io_context& io_context, unsigned int queue_depth, std::size_t buffer_count, std::size_t buffer_size);
+
+  // Copy / Move disabled (the kernel references our memory)
+  FileIoUring(const FileIoUring&)            = delete;
+  FileIoUring& operator=(const FileIoUring&) = delete;
+  FileIoUring(FileIoUring&&)                 = delete;
+  FileIoUring& operator=(FileIoUring&&)      = delete;
+
+  /// Waits for all requests in flight and closes the ring.
+  ~FileIoUring();
+
+  /// Returns whether the ring has been set up successfully.
+  ///
+  /// @return True, if requests can be submitted.
+  bool isOk() const;
+
+  /// Acquires one of the registered buffers.
+  ///
+  /// The buffer is returned to the ring when the last shared_ptr to it is
+  /// released. The buffer may be resized within its capacity.
+  ///
+  /// @return A registered buffer or nullptr, if all buffers are in use.
+  std::shared_ptr<std::vector<char>> acquireBuffer();
+
+  /// Reads from a file at the given offset.
+  ///
+  /// @param fd       The file descriptor to read from.
+  /// @param buffer   The buffer to read into. Its size determines the number of bytes to read.
+  /// @param offset   The file offset to read from.
+  /// @param handler  The handler that is called when the read has completed.
+  void asyncRead(int fd, const std::shared_ptr<std::vector<char>>& buffer, std::uint64_t offset, const CompletionHandler& handler);
+
+  /// Writes to a file at the given offset.
+  ///
+  /// @param fd       The file descriptor to write to.
+  /// @param buffer   The data to write.
+  /// @param offset   The file offset to write to.
+  /// @param handler  The handler that is called when the write has completed.
+  void asyncWrite(int fd, const std::shared_ptr<std::vector<char>>& buffer, std::uint64_t offset, const CompletionHandler& handler);
+
+private:
+  struct Request
+  {
+    bool                               is_write;
+    int                                fd;
+    std::shared_ptr<std::vector<char>> buffer;
+    std::uint64_t                      offset;
+    std::size_t                        done;      ///< Bytes already written by previous (partial) completions
+    CompletionHandler                  handler;
+  };
+
+  struct BufferSlab;
+
+  void submit(std::unique_ptr<Request> request);
+  bool pushSubmission(Request* request);
+  void enter(unsigned int min_complete);
+  void waitForCompletions();
+  void reapCompletions();
+  int  registeredBufferIndex(const std::vector<char>* buffer) const;
+  void teardown();
+
+private:
+  int ring_fd_  = -1;
+  int event_fd_ = -1;
+
+  // Submission queue
+  std::mutex     submission_mutex_;
+  void*          sq_ring_         = nullptr;
+  std::size_t    sq_ring_size_    = 0;
+  unsigned int*  sq_head_         = nullptr;
+  unsigned int*  sq_tail_         = nullptr;
+  unsigned int*  sq_mask_         = nullptr;
+  unsigned int*  sq_array_        = nullptr;
+  unsigned int   sq_entries_      = 0;
+  io_uring_sqe*  sqes_            = nullptr;
+  std::size_t    sqes_size_       = 0;
+  std::deque<std::unique_ptr<Request>> backlog_;   ///< Requests that did not fit into the submission or completion queue
+
+  // Completion queue (only accessed by the single pending eventfd handler)
+  void*          cq_ring_         = nullptr;
+  std::size_t    cq_ring_size_    = 0;
+  unsigned int*  cq_head_         = nullptr;
+  unsigned int*  cq_tail_         = nullptr;
+  unsigned int*  cq_mask_         = nullptr;
+  io_uring_cqe*  cqes_            = nullptr;
+  unsigned int   cq_entries_      = 0;
+
+  std::size_t    requests_in_flight_ = 0;          ///< Protected by submission_mutex_. Never exceeds cq_entries_.
+
+  std::shared_ptr<BufferSlab>     buffer_slab_;
+  bool                            buffers_registered_ = false;
+
+  asio::posix::stream_descriptor  event_descriptor_;
+  std::uint64_t                   event_count_ = 0;
+};
+
+inline bool FileIoUring::isOk() const
+{
+  return ring_fd_ != -1;
+}
+
+}
+
+#endif  // FINEFTP_SERVER_SRC_UNIX_FILE_IO_URING_H_
@@ -2,53 +2,257 @@
 
 #include "file_man.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <fcntl.h>
+#include <functional>
+#include <future>
+#include <ios>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+  #include <sys/utsname.h>
+#endif // __linux__
 #include <unistd.h>
+#include <vector>
+
+#if ((defined(__APPLE__) && defined(__MACH__)) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__))
+  #define ST_MTIM st_mtimespec
+#else
+  #define ST_MTIM st_mtim
+#endif
 
 namespace fineftp
 {
 
   namespace
   {
-    std::mutex                                         guard;
-    std::map<std::string, std::weak_ptr<ReadableFile>> files;
+    /// The open files are distributed over several shards by the hash of
+    /// their path, so threads retrieving different files rarely contend for
+    /// the same lock.
+    struct Shard
+    {
+      std::mutex                                                                 mutex;
+      std::map<std::string, std::weak_ptr<ReadableFile>>                         files;
+      std::map<std::string, std::shared_future<std::shared_ptr<ReadableFile>>>   opening;   ///< Files that are being opened by some thread
+    };
+
+    constexpr std::size_t           shard_count = 16;
+    std::array<Shard, shard_count>  shards;
+
+    Shard& shardOf(const std::string& file_path)
+    {
+      return shards[std::hash<std::string>{}(file_path) % shard_count];
+    }
+
+    std::int64_t modificationTimeNs(const struct stat& file_status)
+    {
+      return (static_cast<std::int64_t>(file_status.ST_MTIM.tv_sec) * 1000000000) + static_cast<std::int64_t>(file_status.ST_MTIM.tv_nsec);
+    }
+
+    std::size_t pageSize()
+    {
+      static const auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+      return page_size;
+    }
+
+    /// Returns the number of bytes at the beginning of the page aligned mapping
+    /// that are in the page cache.
+    std::size_t residentMappingSize(void* map_start, std::size_t map_size)
+    {
+      const std::size_t page_size  = pageSize();
+      const std::size_t page_count = (map_size + page_size - 1) / page_size;
+
+#if defined(__APPLE__) && defined(__MACH__)
+      std::vector<char>          page_residency(page_count);
+#else
+      std::vector<unsigned char> page_residency(page_count);
+#endif
+      if (0 != ::mincore(map_start, map_size, page_residency.data()))
+      {
+        // We don't know, so we don't attempt to avoid blocking
+        return map_size;
+      }
+
+      const auto first_missing_page = std::find_if(page_residency.begin(), page_residency.end(), [](auto residency) { return (residency & 1) == 0; });
+      return std::min(map_size, static_cast<std::size_t>(first_missing_page - page_residency.begin()) * page_size);
+    }
+
+    /// Returns the directory that contains the given file.
+    std::string parentDirectory(const std::string& file_path)
+    {
+      const std::string::size_type separator = file_path.find_last_of('/');
+      if (std::string::npos == separator)
+        return ".";
+      return ((separator == 0) ? std::string("/") : file_path.substr(0, separator));
+    }
+
+    /// Makes the entries of the given directory (e.g. a renamed file) durable.
+    bool syncDirectory(const std::string& directory)
+    {
+      const int handle = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (-1 == handle)
+        return false;
+
+      int result = 0;
+      do
+      {
+        result = ::fsync(handle);
+      } while ((result != 0) && (errno == EINTR));
+
+      ::close(handle);
+      return (result == 0);
+    }
+
+    /// Counts the writeable files that have been opened, so files can be
+    /// ordered by the time they have been opened
+    std::atomic<std::uint64_t> open_counter(0);
+
+#ifdef __linux__
+    /// Returns whether syncfs() reports the writeback errors of the file
+    /// system that occurred since its file descriptor has been opened. Linux
+    /// 5.8 and newer do, older kernels always return success.
+    bool syncfsReportsErrors()
+    {
+      static const bool reports_errors = []()
+                                         {
+                                           struct utsname system_name {};
+                                           int major = 0;
+                                           int minor = 0;
+                                           if ((0 != ::uname(&system_name)) || (2 != std::sscanf(system_name.release, "%d.%d", &major, &minor))) // NOLINT(cert-err34-c) Reason: The release string is checked by the return value
+                                             return false;
+                                           return (major > 5) || ((major == 5) && (minor >= 8));
+                                         }();
+      return reports_errors;
+    }
+
+    /// Flushes the file system that contains the given file descriptor.
+    bool syncFileSystem(int handle)
+    {
+      int result = 0;
+      do
+      {
+        result = ::syncfs(handle);
+      } while ((result != 0) && (errno == EINTR));
+
+      return (result == 0);
+    }
+#endif // __linux__
   }  // namespace
 
+  FileWindow::~FileWindow()
+  {
+    if (nullptr != map_start_)
+    {
+      ::munmap(map_start_, map_size_);
+    }
+  }
+
+  std::size_t FileWindow::residentSize() const
+  {
+    const std::size_t skipped_size = static_cast<std::size_t>(data_ - static_cast<std::uint8_t*>(map_start_));
+    const std::size_t resident_map_size = residentMappingSize(map_start_, map_size_);
+    return ((resident_map_size > skipped_size) ? std::min(size_, resident_map_size - skipped_size) : 0);
+  }
+
   ReadableFile::~ReadableFile()
   {
-    if (nullptr != data_)
+    if (nullptr != residency_map_)
     {
-      ::munmap(data_, size_);
+      ::munmap(residency_map_, size_);
     }
 
-    const std::lock_guard<std::mutex> lock{guard};
-    if (!path_.empty())
+    if (-1 != handle_)
     {
-      (void)files.erase(path_);
+      ::close(handle_);
+    }
+
+    // The path may already refer to a newer file, that must stay in the map
+    Shard& shard = shardOf(path_);
+    const std::lock_guard<std::mutex> lock{shard.mutex};
+    auto existing_files_it = shard.files.find(path_);
+    if ((shard.files.end() != existing_files_it) && existing_files_it->second.expired())
+    {
+      (void)shard.files.erase(existing_files_it);
     }
   }
 
   std::shared_ptr<ReadableFile> ReadableFile::get(const std::string& file_path)
   {
-    // See if we already have this file mapped
-    const std::lock_guard<std::mutex> lock{guard};
-    auto existing_files_it = files.find(file_path);
-    if (files.end() != existing_files_it)
+    Shard& shard = shardOf(file_path);
+
+    // See if we already have this file opened. Validating it is a syscall, so
+    // it is done without holding the lock.
+    std::shared_ptr<ReadableFile> existing_file;
     {
-      auto readable_file_ptr = existing_files_it->second.lock();
+      const std::lock_guard<std::mutex> lock{shard.mutex};
+      auto existing_files_it = shard.files.find(file_path);
+      if (shard.files.end() != existing_files_it)
+      {
+        existing_file = existing_files_it->second.lock();
+      }
+    }
+    if (existing_file && existing_file->isUpToDate())
+    {
+      return existing_file;
+    }
+
+    // Either wait for another thread that is opening the file right now, or
+    // open it ourselves and let the others wait for us.
+    std::promise<std::shared_ptr<ReadableFile>> opened_file_promise;
+    {
+      std::unique_lock<std::mutex> lock{shard.mutex};
+
+      auto existing_files_it = shard.files.find(file_path);
+      if (shard.files.end() != existing_files_it)
+      {
+        // Another thread may have replaced the stale file in the meantime
+        auto readable_file_ptr = existing_files_it->second.lock();
+        if (readable_file_ptr && (readable_file_ptr != existing_file))
+        {
+          return readable_file_ptr;
+        }
+      }
+
+      auto opening_it = shard.opening.find(file_path);
+      if (shard.opening.end() != opening_it)
+      {
+        auto opened_file_future = opening_it->second;
+        lock.unlock();
+        return opened_file_future.get();
+      }
+
+      shard.opening.emplace(file_path, opened_file_promise.get_future().share());
+    }
+
+    auto readable_file_ptr = open(file_path);
+
+    {
+      const std::lock_guard<std::mutex> lock{shard.mutex};
       if (readable_file_ptr)
       {
-        return readable_file_ptr;
+        shard.files[file_path] = readable_file_ptr;
       }
+      (void)shard.opening.erase(file_path);
     }
 
+    opened_file_promise.set_value(readable_file_ptr);
+    return readable_file_ptr;
+  }
+
+  std::shared_ptr<ReadableFile> ReadableFile::open(const std::string& file_path)
+  {
     auto handle = ::open(file_path.c_str(), O_RDONLY);
     if (-1 == handle)
     {
@@ -56,32 +260,520 @@ namespace fineftp
     }
 
     struct stat file_status {};
-    if (-1 == ::fstat(handle, &file_status))
+    if ((-1 == ::fstat(handle, &file_status)) || !S_ISREG(file_status.st_mode))
     {
+      // Only regular files can be sent (e.g. no directories)
       ::close(handle);
       return {};
     }
 
-    void* map_start = nullptr;
+    // The file is not mapped as a whole for reading. Segments of it get
+    // mapped on demand by mapWindow(), so huge files don't occupy the address
+    // space on 32 bit systems.
+    std::shared_ptr<ReadableFile> readable_file_ptr{new ReadableFile{}};
+    readable_file_ptr->path_        = file_path;
+    readable_file_ptr->size_        = file_status.st_size;
+    readable_file_ptr->handle_      = handle;
+    readable_file_ptr->device_      = file_status.st_dev;
+    readable_file_ptr->inode_       = file_status.st_ino;
+    readable_file_ptr->mtime_ns_    = modificationTimeNs(file_status);
 
-    if (file_status.st_size > 0)
+    // The residency of the pages is queried for every chunk that is sent.
+    // Mapping and unmapping the file each time would make every io thread
+    // flush its TLB, so a single mapping is kept for the lifetime of the
+    // file. On 32 bit systems, we don't spend the address space on that.
+    if ((sizeof(void*) >= 8) && (readable_file_ptr->size_ > 0))
     {
-      // Only mmap file with a size > 0
-      map_start = ::mmap(nullptr, file_status.st_size, PROT_READ, MAP_SHARED, handle, 0);
-      if (MAP_FAILED == map_start)
+      void* residency_map = ::mmap(nullptr, readable_file_ptr->size_, PROT_READ, MAP_SHARED, handle, 0);
+      if (MAP_FAILED != residency_map)
+        readable_file_ptr->residency_map_ = residency_map;
+    }
+    return readable_file_ptr;
+  }
+
+  bool ReadableFile::isUpToDate() const
+  {
+    struct stat file_status {};
+    if (-1 == ::stat(path_.c_str(), &file_status))
+    {
+      return false;
+    }
+
+    return (file_status.st_dev == device_)
+        && (file_status.st_ino == inode_)
+        && (static_cast<std::size_t>(file_status.st_size) == size_)
+        && (modificationTimeNs(file_status) == mtime_ns_);
+  }
+
+  std::shared_ptr<FileWindow> ReadableFile::mapWindow(std::size_t offset, std::size_t size) const
+  {
+    if ((offset >= size_) || (size == 0))
+    {
+      return {};
+    }
+
+    size = std::min(size, size_ - offset);
+
+    // mmap requires the offset to be a multiple of the page size
+    const std::size_t page_size  = pageSize();
+    const std::size_t map_offset = offset - (offset % page_size);
+    const std::size_t map_size   = size + (offset - map_offset);
+
+    void* map_start = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, handle_, static_cast<off_t>(map_offset));
+    if (MAP_FAILED == map_start)
+    {
+      return {};
+    }
+
+    // Tell the kernel that we are going to read the window from front to back
+    // and that it can start reading it right now.
+    (void)::madvise(map_start, map_size, MADV_SEQUENTIAL);
+    (void)::madvise(map_start, map_size, MADV_WILLNEED);
+
+    std::shared_ptr<FileWindow> window{new FileWindow{}};
+    window->map_start_ = map_start;
+    window->map_size_  = map_size;
+    window->offset_    = offset;
+    window->size_      = size;
+    window->data_      = static_cast<std::uint8_t*>(map_start) + (offset - map_offset);
+    return window;
+  }
+
+  void ReadableFile::prefetch(std::size_t offset, std::size_t size) const
+  {
+#if defined(POSIX_FADV_WILLNEED)
+    if (offset < size_)
+    {
+      size = std::min(size, size_ - offset);
+      (void)::posix_fadvise(handle_, static_cast<off_t>(offset), static_cast<off_t>(size), POSIX_FADV_WILLNEED);
+    }
+#else
+    static_cast<void>(offset);
+    static_cast<void>(size);
+#endif
+  }
+
+  std::size_t ReadableFile::residentSize(std::size_t offset, std::size_t size) const
+  {
+    if (offset >= size_)
+    {
+      return 0;
+    }
+    size = std::min(size, size_ - offset);
+
+    // The residency can only be queried for mapped memory. Mapping the file
+    // without touching it does not read anything from the disk.
+    const std::size_t map_offset = offset - (offset % pageSize());
+    const std::size_t map_size   = size + (offset - map_offset);
+
+    if (nullptr != residency_map_)
+    {
+      const std::size_t resident_map_size = residentMappingSize(static_cast<char*>(residency_map_) + map_offset, map_size);
+      return ((resident_map_size > (offset - map_offset)) ? std::min(size, resident_map_size - (offset - map_offset)) : 0);
+    }
+
+    void* map_start = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, handle_, static_cast<off_t>(map_offset));
+    if (MAP_FAILED == map_start)
+    {
+      return size;
+    }
+
+    const std::size_t resident_map_size = residentMappingSize(map_start, map_size);
+    ::munmap(map_start, map_size);
+
+    return ((resident_map_size > (offset - map_offset)) ? std::min(size, resident_map_size - (offset - map_offset)) : 0);
+  }
+
+  void ReadableFile::load(std::size_t offset, std::size_t size) const
+  {
+    constexpr std::size_t buffer_size = 256 * 1024;
+    thread_local std::vector<char> buffer(buffer_size);
+
+    const std::size_t end = std::min(size_, offset + size);
+    while (offset < end)
+    {
+      const ssize_t bytes_read = ::pread(handle_, buffer.data(), std::min(buffer_size, end - offset), static_cast<off_t>(offset));
+      if (bytes_read > 0)
+      {
+        offset += static_cast<std::size_t>(bytes_read);
+      }
+      else if ((bytes_read < 0) && (errno == EINTR))
+      {
+        continue;
+      }
+      else
       {
-        ::close(handle);
-        return {};
+        // The file has been truncated or cannot be read. The transfer will find out.
+        return;
       }
     }
+  }
 
-    ::close(handle);
+  void ReadableFile::dropFromCache(std::size_t offset, std::size_t size) const
+  {
+#if defined(POSIX_FADV_DONTNEED)
+    // The kernel only drops pages that are completely covered by the range
+    const std::size_t page_offset = offset - (offset % pageSize());
+    (void)::posix_fadvise(handle_, static_cast<off_t>(page_offset), static_cast<off_t>(size + (offset - page_offset)), POSIX_FADV_DONTNEED);
+#else
+    static_cast<void>(offset);
+    static_cast<void>(size);
+#endif
+  }
 
-    std::shared_ptr<ReadableFile> readable_file_ptr{new ReadableFile{}};
-    readable_file_ptr->path_        = file_path;
-    readable_file_ptr->size_        = file_status.st_size;
-    readable_file_ptr->data_        = static_cast<uint8_t*>(map_start);
-    files[readable_file_ptr->path_] = readable_file_ptr;
-    return readable_file_ptr;
+  WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mode, std::uint64_t offset)
+    : offset_       (offset)
+    , open_sequence_(++open_counter)
+    , filename_     (filename)
+  {
+    // std::ios::binary is ignored, as there is no difference between text and
+    // binary files on this platform.
+    //
+    // Appending does not use O_APPEND, as that would make positional writes
+    // ignore their offset. Instead, we start writing at the current end of
+    // the file.
+    const bool append   = ((mode & std::ios::app) == std::ios::app);
+    const bool truncate = (!append && (offset == 0));
+    const int  flags    = O_WRONLY | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+
+    // Find out whether the file is created, as its directory entry has to
+    // be synced to make it durable
+    handle_  = ::open(filename.c_str(), flags | O_EXCL, 0666);
+    created_ = (-1 != handle_);
+    if (!created_ && (errno == EEXIST))
+    {
+      handle_ = ::open(filename.c_str(), flags, 0666);
+    }
+    if (-1 == handle_)
+    {
+      return;
+    }
+
+    if (append)
+    {
+      struct stat file_status {};
+      if (-1 == ::fstat(handle_, &file_status))
+      {
+        close();
+        return;
+      }
+      offset_ = static_cast<std::uint64_t>(file_status.st_size);
+    }
+
+    good_ = true;
+  }
+
+  WriteableFile::~WriteableFile()
+  {
+    close();
+  }
+
+  void WriteableFile::write(const char* data, std::size_t sz)
+  {
+    while (good_ && (sz > 0))
+    {
+      const ssize_t bytes_written = ::pwrite(handle_, data, sz, static_cast<off_t>(offset_));
+      if (bytes_written < 0)
+      {
+        if (errno != EINTR)
+          good_ = false;
+        continue;
+      }
+
+      data    += bytes_written;
+      sz      -= static_cast<std::size_t>(bytes_written);
+      offset_ += static_cast<std::uint64_t>(bytes_written);
+    }
+  }
+
+  void WriteableFile::write(const std::vector<std::shared_ptr<std::vector<char>>>& buffers)
+  {
+    std::vector<struct iovec> iovecs;
+    iovecs.reserve(buffers.size());
+    for (const auto& buffer : buffers)
+    {
+      if (!buffer->empty())
+        iovecs.push_back({buffer->data(), buffer->size()});
+    }
+
+    // Write all buffers with as few system calls as possible. Partially
+    // written buffers are continued with the next call.
+    std::size_t first = 0;
+    while (good_ && (first < iovecs.size()))
+    {
+      const int     count         = static_cast<int>(std::min<std::size_t>(iovecs.size() - first, IOV_MAX));
+      const ssize_t bytes_written = ::pwritev(handle_, &iovecs[first], count, static_cast<off_t>(offset_));
+      if (bytes_written < 0)
+      {
+        if (errno != EINTR)
+          good_ = false;
+        continue;
+      }
+
+      offset_ += static_cast<std::uint64_t>(bytes_written);
+
+      auto remaining = static_cast<std::size_t>(bytes_written);
+      while ((first < iovecs.size()) && (remaining >= iovecs[first].iov_len))
+      {
+        remaining -= iovecs[first].iov_len;
+        ++first;
+      }
+      if (remaining > 0)
+      {
+        iovecs[first].iov_base = static_cast<char*>(iovecs[first].iov_base) + remaining;
+        iovecs[first].iov_len -= remaining;
+      }
+    }
+  }
+
+  bool WriteableFile::preallocate(std::uint64_t size)
+  {
+#ifdef __linux__
+    if (!good_ || (size == 0))
+      return true;
+
+    // The size of the file is kept, so concurrent readers (and the file
+    // after a crash) never contain space that has not been written to
+    int result = 0;
+    do
+    {
+      result = ::fallocate(handle_, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset_), static_cast<off_t>(size));
+    } while ((result != 0) && (errno == EINTR));
+
+    if (result != 0)
+      return (errno != ENOSPC) && (errno != EDQUOT) && (errno != EFBIG);
+    return true;
+#else
+    // There is no portable way to allocate space without changing the file
+    // size, so we leave the allocation to the file system.
+    (void)size;
+    return true;
+#endif // __linux__
+  }
+
+  bool WriteableFile::sync()
+  {
+    if (!good_)
+      return false;
+
+    int result = 0;
+    do
+    {
+#if defined(__APPLE__)
+      result = ::fsync(handle_);
+#else
+      result = ::fdatasync(handle_);
+#endif
+    } while ((result != 0) && (errno == EINTR));
+
+    return (result == 0);
+  }
+
+  std::vector<bool> WriteableFile::sync(const std::vector<std::shared_ptr<WriteableFile>>& files)
+  {
+    std::vector<bool> durable(files.size(), false);
+
+#ifdef __linux__
+    if (syncfsReportsErrors())
+    {
+      // A single syncfs() per file system flushes the data of all files with
+      // one journal commit and one disk flush, no matter how many files there
+      // are. It also flushes unrelated data of the file system, though. It
+      // reports all writeback errors of the file system since the descriptor
+      // has been opened, so it is called on the file that has been opened
+      // first. An error of any file therefore fails all files on the file
+      // system, which errs on the safe side.
+      std::map<dev_t, std::vector<std::size_t>> files_by_device;
+      for (std::size_t i = 0; i < files.size(); i++)
+      {
+        struct stat file_status {};
+        if (files[i]->good_ && (0 == ::fstat(files[i]->handle_, &file_status)))
+          files_by_device[file_status.st_dev].push_back(i);
+      }
+
+      for (const auto& device_files : files_by_device)
+      {
+        const std::size_t first_opened = *std::min_element(device_files.second.begin(), device_files.second.end()
+                                                         , [&files](std::size_t lhs, std::size_t rhs) { return files[lhs]->open_sequence_ < files[rhs]->open_sequence_; });
+
+        const bool synced = syncFileSystem(files[first_opened]->handle_);
+        for (const std::size_t index : device_files.second)
+          durable[index] = synced;
+      }
+      return durable;
+    }
+#endif // __linux__
+
+    // Older kernels don't report writeback errors with syncfs(), so each
+    // file is flushed on its own
+    for (std::size_t i = 0; i < files.size(); i++)
+      durable[i] = files[i]->sync();
+    return durable;
+  }
+
+  std::uint64_t WriteableFile::reserve(std::size_t sz)
+  {
+    const std::uint64_t offset = offset_;
+    offset_ += sz;
+    return offset;
+  }
+
+  void WriteableFile::close()
+  {
+    if (-1 != handle_)
+    {
+      if (0 != ::close(handle_))
+      {
+        good_ = false;
+      }
+      handle_ = -1;
+
+      // A temporary file that has not been committed is not needed anymore
+      if (!commit_target_.empty())
+      {
+        ::unlink(filename_.c_str());
+        commit_target_.clear();
+      }
+    }
+  }
+
+  void WriteableFile::setCommitTarget(const std::string& target_filename)
+  {
+    commit_target_ = target_filename;
+
+    // The file replaces the target, so it takes over the permissions of an
+    // existing target (e.g. the x bit), just like a file that is truncated
+    // and overwritten in place keeps them. This is done before any data is
+    // written, so syncing the file makes the permissions durable, too.
+    struct stat target_status {};
+    if ((-1 != handle_) && (0 == ::stat(target_filename.c_str(), &target_status)))
+    {
+      (void)::fchmod(handle_, target_status.st_mode & 07777);
+    }
+  }
+
+  bool WriteableFile::commit(bool durable)
+  {
+    const bool        replaces_target = !commit_target_.empty();
+    const std::string target_filename = (replaces_target ? commit_target_ : filename_);
+
+    // The data must be on the disk before the file is put in place, or a
+    // crash may leave the target with the new name but without the new data
+    if (durable && !sync())
+    {
+      close();
+      good_ = false;
+      return false;
+    }
+
+    if (!putInPlace())
+      return false;
+
+    // A rename or a new file is only durable once the directory has been synced
+    return !(durable && (replaces_target || created_)) || syncDirectory(parentDirectory(target_filename));
+  }
+
+  std::vector<bool> WriteableFile::commit(const std::vector<std::shared_ptr<WriteableFile>>& files)
+  {
+    // The data of all files is synced before any of them is put in place
+    std::vector<bool> committed = sync(files);
+
+    // The new and renamed directory entries have to be synced afterwards.
+    // With syncfs(), a directory of each file system is opened before the
+    // renames, so a single syncfs() on it makes all of the entries durable
+    // and reports the errors since. Otherwise, each directory is synced once.
+    std::map<std::string, std::vector<std::size_t>> files_by_directory;
+#ifdef __linux__
+    std::map<dev_t, int>                            device_handles;
+    std::map<dev_t, std::vector<std::size_t>>       files_by_device;
+#endif // __linux__
+    for (std::size_t i = 0; i < files.size(); i++)
+    {
+      if (!committed[i])
+      {
+        files[i]->close();
+        files[i]->good_ = false;
+        continue;
+      }
+
+      const bool replaces_target = !files[i]->commit_target_.empty();
+      if (!replaces_target && !files[i]->created_)
+        continue;
+
+      const std::string directory = parentDirectory(replaces_target ? files[i]->commit_target_ : files[i]->filename_);
+#ifdef __linux__
+      struct stat file_status {};
+      if (syncfsReportsErrors() && (0 == ::fstat(files[i]->handle_, &file_status)))
+      {
+        auto handle_it = device_handles.find(file_status.st_dev);
+        if (handle_it == device_handles.end())
+          handle_it = device_handles.emplace(file_status.st_dev, ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)).first;
+
+        if (-1 != handle_it->second)
+        {
+          files_by_device[file_status.st_dev].push_back(i);
+          continue;
+        }
+      }
+#endif // __linux__
+      files_by_directory[directory].push_back(i);
+    }
+
+    for (std::size_t i = 0; i < files.size(); i++)
+    {
+      if (committed[i])
+        committed[i] = files[i]->putInPlace();
+    }
+
+#ifdef __linux__
+    for (const auto& device_handle : device_handles)
+    {
+      if (-1 == device_handle.second)
+        continue;
+
+      const bool synced = syncFileSystem(device_handle.second);
+      ::close(device_handle.second);
+      if (!synced)
+      {
+        for (const std::size_t index : files_by_device[device_handle.first])
+          committed[index] = false;
+      }
+    }
+#endif // __linux__
+
+    for (const auto& directory_files : files_by_directory)
+    {
+      if (!syncDirectory(directory_files.first))
+      {
+        for (const std::size_t index : directory_files.second)
+          committed[index] = false;
+      }
+    }
+
+    return committed;
+  }
+
+  bool WriteableFile::putInPlace()
+  {
+    if (commit_target_.empty())
+    {
+      close();
+      return good_;
+    }
+
+    const std::string target_filename = commit_target_;
+    commit_target_.clear();
+    close();
+
+    // rename() replaces an existing target atomically, so readers either see
+    // the old or the new file, but never a partially written one.
+    if (good_ && (0 == ::rename(filename_.c_str(), target_filename.c_str())))
+    {
+      return true;
+    }
+
+    ::unlink(filename_.c_str());
+    good_ = false;
+    return false;
   }
 }
@@ -5,16 +5,61 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <fstream>
 #include <ios>
 #include <memory>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 namespace fineftp
 {
 
-/// A memory mapped read-only file.
+/// A read-only memory mapped segment of a ReadableFile.
+///
+/// The segment stays mapped for as long as the FileWindow exists. It remains
+/// valid even if the ReadableFile it has been created from is destroyed.
+class FileWindow
+{
+public:
+  FileWindow(const FileWindow&)            = delete;
+  FileWindow& operator=(const FileWindow&) = delete;
+  FileWindow(FileWindow&&)                 = delete;
+  FileWindow& operator=(FileWindow&&)      = delete;
+  ~FileWindow();
+
+  /// Returns the offset of the window in the file.
+  ///
+  /// @return The offset of the first byte of the window.
+  std::size_t offset() const;
+
+  /// Returns the size of the window.
+  ///
+  /// @return The size of the window.
+  std::size_t size() const;
+
+  /// Returns a pointer to the beginning of the window contents.
+  ///
+  /// @return A pointer to the file contents at offset().
+  const std::uint8_t* data() const;
+
+  /// Returns how much of the window can be read without waiting for the disk.
+  ///
+  /// @return The number of bytes from the beginning of the window that are
+  ///         in the page cache.
+  std::size_t residentSize() const;
+
+private:
+  friend class ReadableFile;
+  FileWindow() = default;
+
+  void*         map_start_ = {};  ///< Page aligned start of the mapping
+  std::size_t   map_size_  = {};  ///< Size of the mapping
+  std::size_t   offset_    = {};
+  std::size_t   size_      = {};
+  std::uint8_t* data_      = {};
+};
+
+/// A read-only file that is mapped into memory segment by segment.
 ///
 /// @note The implementation is NOT thread safe!
 class ReadableFile
@@ -28,6 +73,13 @@ public:
 
   /// Retrieves the file at the specified path.
   ///
+  /// If the file is already open, the open file is shared, unless the path
+  /// refers to a different or modified file by now (see isUpToDate()).
+  /// Concurrent calls for the same path that is not open yet wait for a single
+  /// thread opening the file.
+  ///
+  /// @note This function is thread safe.
+  ///
   /// @param file_path      The path of the file.
   ///
   /// @param The requested file or nullptr if the file could not be retrieved.
@@ -38,26 +90,100 @@ public:
   /// @return The size of the file.
   std::size_t size() const;
 
-  /// Returns a pointer to the beginning of the file contents.
+  /// Checks whether the path of the file still refers to the same, unmodified
+  /// file.
   ///
-  /// @return A pointer to the beginning of the file contents.
-  const std::uint8_t* data() const;
+  /// The path is stat'ed and compared to the device, inode, size and
+  /// modification time the file had when it was opened. A file that has been
+  /// replaced (e.g. by a rename) or rewritten is not up to date anymore.
+  ///
+  /// @return True, if the file at path() is still the file that is open.
+  bool isUpToDate() const;
+
+  /// Maps a segment of the file into memory.
+  ///
+  /// The kernel is advised to read the segment sequentially and to start
+  /// reading it ahead right away. If the segment exceeds the end of the
+  /// file, the returned window is shortened accordingly.
+  ///
+  /// @param offset   The offset of the first byte to map.
+  /// @param size     The maximum number of bytes to map.
+  ///
+  /// @return The mapped window or nullptr if the segment could not be mapped.
+  std::shared_ptr<FileWindow> mapWindow(std::size_t offset, std::size_t size) const;
+
+  /// Advises the kernel to read the given segment of the file ahead.
+  ///
+  /// @param offset   The offset of the first byte that will be needed soon.
+  /// @param size     The number of bytes that will be needed soon.
+  void prefetch(std::size_t offset, std::size_t size) const;
+
+  /// Returns how much of the given segment can be read without waiting for
+  /// the disk.
+  ///
+  /// @param offset   The offset of the first byte of the segment.
+  /// @param size     The size of the segment.
+  ///
+  /// @return The number of bytes from offset on that are in the page cache.
+  std::size_t residentSize(std::size_t offset, std::size_t size) const;
+
+  /// Reads the given segment of the file into the page cache.
+  ///
+  /// This blocks until the data has been read and must therefore not be
+  /// called on an io thread (see FilePrefetcher).
+  ///
+  /// @param offset   The offset of the first byte to read.
+  /// @param size     The number of bytes to read.
+  void load(std::size_t offset, std::size_t size) const;
+
+  /// Advises the kernel to drop the given segment of the file from the page
+  /// cache, as it will not be needed again soon.
+  ///
+  /// Pages that are still in use (e.g. mapped) are kept. A page that is only
+  /// partially covered by the segment is dropped as well.
+  ///
+  /// @param offset   The offset of the first byte that is not needed anymore.
+  /// @param size     The number of bytes that are not needed anymore.
+  void dropFromCache(std::size_t offset, std::size_t size) const;
 
   /// Returns the path of the file.
   ///
   /// @return The path of the file.
   const std::string& path() const;
 
+  /// Returns the native file descriptor of the file.
+  ///
+  /// The descriptor stays open for the lifetime of the ReadableFile, so it can
+  /// be used for zero-copy transfers (e.g. sendfile(2)).
+  ///
+  /// @return The file descriptor of the file.
+  int handle() const;
+
 private:
   ReadableFile() = default;
 
-  std::string   path_   = {};
-  std::size_t   size_   = {};
-  std::uint8_t* data_   = {};
+  /// Opens the file without sharing it.
+  static std::shared_ptr<ReadableFile> open(const std::string& file_path);
+
+  std::string   path_     = {};
+  std::size_t   size_     = {};
+  int           handle_   = -1;
+  dev_t         device_   = {};
+  ino_t         inode_    = {};
+  std::int64_t  mtime_ns_ = {};
+
+  /// Mapping of the whole file that is only used to query which pages are
+  /// resident (see residentSize()). It is never accessed, so it doesn't read
+  /// anything from the disk. nullptr, if the file could not be mapped.
+  void*         residency_map_ = nullptr;
 };
 
 
-/// @brief A writeable file tailored for the Win32 environment.
+/// @brief A writeable file that is written through its file descriptor.
+///
+/// Data is written with pwrite(2) at an offset that is tracked by the file
+/// itself. Instead of writing synchronously, callers may reserve a range of
+/// the file with reserve() and write it asynchronously through handle().
 class WriteableFile
 {
 public:
@@ -65,12 +191,9 @@ public:
   ///
   /// @param filename  The (UTF-8 encoded) name of the file.
   /// @param mode      The open mode to use for the file (std::ios::out is implied).
-  WriteableFile(const std::string& filename, std::ios::openmode mode)
-    : file_stream_(filename, std::ios::out | mode)
-    , stream_buffer_(1024 * 1024)
-  {
-    file_stream_.rdbuf()->pubsetbuf(stream_buffer_.data(), static_cast<std::streamsize>(stream_buffer_.size()));
-  }
+  /// @param offset    The offset to start writing at. If not 0, an existing
+  ///                  file is not truncated. Ignored in append mode.
+  WriteableFile(const std::string& filename, std::ios::openmode mode, std::uint64_t offset = 0);
 
   // Copy disabled
   WriteableFile(const WriteableFile&)            = delete;
@@ -80,30 +203,103 @@ public:
   WriteableFile& operator=(WriteableFile&&)      = delete;
   WriteableFile(WriteableFile&&)                 = delete;
 
-  ~WriteableFile()
-  {
-    close();
-  }
+  ~WriteableFile();
+
+  void write(const char* data, std::size_t sz);
 
-  void write(const char* data, std::size_t sz)
-  {
-    file_stream_.write(data, static_cast<std::streamsize>(sz));
-  }
+  /// Writes the given buffers one after another. On Linux, all buffers are
+  /// passed to the kernel at once.
+  ///
+  /// @param buffers  The data to write.
+  void write(const std::vector<std::shared_ptr<std::vector<char>>>& buffers);
+
+  /// Allocates disk space for the next size bytes of the file, so the data
+  /// does not have to be allocated piece by piece while it is written. The
+  /// size of the file does not change until the data is written. Failures
+  /// other than a lack of space are ignored, as the preallocation is just an
+  /// optimization.
+  ///
+  /// @param size   The number of bytes that are going to be written.
+  ///
+  /// @return False, if there is not enough space on the disk.
+  bool preallocate(std::uint64_t size);
+
+  /// Makes the data written so far durable.
+  ///
+  /// @return True, if the data has been flushed to the disk.
+  bool sync();
+
+  /// Makes the data written to all given files durable.
+  ///
+  /// On Linux 5.8 and newer, each file system is flushed once for all files
+  /// on it. Otherwise, the files are flushed one after another.
+  ///
+  /// @param files  The files to sync.
+  ///
+  /// @return For each file, whether its data has been flushed to the disk.
+  static std::vector<bool> sync(const std::vector<std::shared_ptr<WriteableFile>>& files);
+
+  /// Turns the file into a temporary file that replaces the given target
+  /// file when it is committed. If the file is closed (or destroyed) without
+  /// being committed, it is removed, so an aborted upload leaves no debris.
+  /// The file takes over the permission bits of an existing target file.
+  ///
+  /// @param target_filename  The (UTF-8 encoded) name of the file to replace.
+  void setCommitTarget(const std::string& target_filename);
+
+  /// Closes the file. A temporary file (see setCommitTarget()) atomically
+  /// replaces its target file.
+  ///
+  /// @param durable  Whether the file has to survive a crash. The data is
+  ///                 then synced before and the directory after the rename
+  ///                 (or after the file has been created). This blocks until
+  ///                 the disk has flushed the data.
+  ///
+  /// @return True, if all data has been written and the file is in place.
+  bool commit(bool durable = false);
 
-  void close()
-  {
-    file_stream_.flush();
-    file_stream_.close();
-  }
+  /// Commits all given files durably (see commit()). The data of all files
+  /// is synced first (see sync()). After the renames, the directory entries
+  /// are synced with one more flush of each file system on Linux 5.8 and
+  /// newer, otherwise each affected directory is synced once.
+  ///
+  /// @param files  The files to commit.
+  ///
+  /// @return For each file, whether it is durably in place.
+  static std::vector<bool> commit(const std::vector<std::shared_ptr<WriteableFile>>& files);
+
+  void close();
+  bool good() const;
+
+  /// The (UTF-8 encoded) name of the file that is written. This is the
+  /// temporary file, if setCommitTarget() has been called.
+  const std::string& filename() const;
+
+  /// Reserves the next sz bytes of the file for a write that is performed by
+  /// the caller.
+  ///
+  /// @param sz   The number of bytes that will be written.
+  ///
+  /// @return The file offset the data has to be written to.
+  std::uint64_t reserve(std::size_t sz);
 
-  bool good() const
-  {
-    return file_stream_.good();
-  }
+  /// Returns the native file descriptor of the file.
+  ///
+  /// @return The file descriptor or -1 if the file is not open.
+  int handle() const;
 
 private:
-  std::fstream      file_stream_;
-  std::vector<char> stream_buffer_;
+  /// Closes the file and renames a temporary file to its commit target.
+  bool putInPlace();
+
+  int           handle_  = -1;
+  std::uint64_t offset_  = 0;
+  bool          good_    = false;
+  bool          created_ = false;   ///< Whether the file has been created by the constructor
+  std::uint64_t open_sequence_ = 0; ///< Files that have been opened later have larger numbers
+
+  std::string   filename_;
+  std::string   commit_target_;     ///< The file that is replaced by commit(), empty if this is not a temporary file
 };
 
 
@@ -112,7 +308,17 @@ inline std::size_t ReadableFile::size() const
   return size_;
 }
 
-inline const std::uint8_t* ReadableFile::data() const
+inline std::size_t FileWindow::offset() const
+{
+  return offset_;
+}
+
+inline std::size_t FileWindow::size() const
+{
+  return size_;
+}
+
+inline const std::uint8_t* FileWindow::data() const
 {
   return data_;
 }
@@ -122,6 +328,26 @@ inline const std::string& ReadableFile::path() const
   return path_;
 }
 
+inline int ReadableFile::handle() const
+{
+  return handle_;
+}
+
+inline bool WriteableFile::good() const
+{
+  return good_;
+}
+
+inline const std::string& WriteableFile::filename() const
+{
+  return filename_;
+}
+
+inline int WriteableFile::handle() const
+{
+  return handle_;
+}
+
 }
 
 #endif  // FINEFTP_SERVER_SRC_UNIX_FILE_MAN_H_
@@ -8,6 +8,7 @@
 
 #include "ftp_user.h"
 #include <fineftp/permissions.h>
+#include <fineftp/user_settings.h>
 
 namespace fineftp
 {
@@ -21,7 +22,7 @@ namespace fineftp
 #endif // NDEBUG
   }
 
-  bool UserDatabase::addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions)
+  bool UserDatabase::addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions, const UserSettings& settings)
   {
     const std::lock_guard<decltype(database_mutex_)> database_lock(database_mutex_);
 
@@ -34,7 +35,7 @@ namespace fineftp
       }
       else
       {
-        anonymous_user_ = std::make_shared<FtpUser>(password, local_root_path, permissions);
+        anonymous_user_ = std::make_shared<FtpUser>(password, local_root_path, permissions, settings);
 #ifndef NDEBUG
         output_ << "Successfully added anonymous user." << std::endl;
 #endif // !NDEBUG
@@ -46,7 +47,7 @@ namespace fineftp
       auto user_it = database_.find(username);
       if (user_it == database_.end())
       {
-        database_.emplace(username, std::make_shared<FtpUser>(password, local_root_path, permissions));
+        database_.emplace(username, std::make_shared<FtpUser>(password, local_root_path, permissions, settings));
 #ifndef NDEBUG
         output_ << "Successfully added user \"" << username << "\"." << std::endl;
 #endif // !NDEBUG
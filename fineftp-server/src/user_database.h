@@ -7,6 +7,7 @@
 
 #include "ftp_user.h"
 #include <fineftp/permissions.h>
+#include <fineftp/user_settings.h>
 
 namespace fineftp
 {
@@ -15,7 +16,7 @@ namespace fineftp
   public:
     UserDatabase(std::ostream& output, std::ostream& error);
 
-    bool addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions);
+    bool addUser(const std::string& username, const std::string& password, const std::string& local_root_path, Permission permissions, const UserSettings& settings);
 
     std::shared_ptr<FtpUser> getUser(const std::string& username, const std::string& password) const;
 
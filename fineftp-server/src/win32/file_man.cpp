@@ -2,6 +2,8 @@
 
 #include "file_man.h"
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <ios>
 #include <map>
@@ -30,21 +32,26 @@ std::map<ReadableFile::Str, std::weak_ptr<ReadableFile>> files;
 
 }  // namespace
 
-ReadableFile::~ReadableFile()
+FileWindow::~FileWindow()
 {
-  if (data_ != nullptr)
-    ::UnmapViewOfFile(data_);
+  if (view_start_ != nullptr)
+    ::UnmapViewOfFile(view_start_);
+}
 
+ReadableFile::~ReadableFile()
+{
   if (map_handle_ != INVALID_HANDLE_VALUE)
     ::CloseHandle(map_handle_);
 
   if (handle_ != INVALID_HANDLE_VALUE)
     ::CloseHandle(handle_);
 
+  // The path may already refer to a newer file, that must stay in the map
   const std::lock_guard<std::mutex> lock{guard};
-  if (!path_.empty())
+  auto existing_files_it = files.find(path_);
+  if ((files.end() != existing_files_it) && existing_files_it->second.expired())
   {
-    (void)files.erase(path_);
+    (void)files.erase(existing_files_it);
   }
 }
 
@@ -71,7 +78,7 @@ std::shared_ptr<ReadableFile> ReadableFile::get(const Str& file_path)
   if (files.end() != existing_files_it)
   {
     auto readable_file_ptr = existing_files_it->second.lock();
-    if (readable_file_ptr)
+    if (readable_file_ptr && readable_file_ptr->isUpToDate())
     {
       return readable_file_ptr;
     }
@@ -102,19 +109,21 @@ std::shared_ptr<ReadableFile> ReadableFile::get(const Str& file_path)
 
   // Create new ReadableFile ptr
   std::shared_ptr<ReadableFile> readable_file_ptr(new ReadableFile{});
+  readable_file_ptr->creation_time_   = file_info.ftCreationTime;
+  readable_file_ptr->last_write_time_ = file_info.ftLastWriteTime;
 
   if (file_size.QuadPart == 0)
   { 
     // Handle zero-size files
     readable_file_ptr->path_        = std::move(file_path_fixed_separators);
     readable_file_ptr->size_        = file_size.QuadPart;
-    readable_file_ptr->data_        = static_cast<uint8_t*>(nullptr);
     readable_file_ptr->handle_      = file_handle;
     readable_file_ptr->map_handle_  = INVALID_HANDLE_VALUE;
   }
   else
   {
-    // Handle non-zero-size files
+    // Handle non-zero-size files. Views of the file are only created on
+    // demand by mapWindow(), so huge files don't occupy the address space.
     auto* map_handle = ::CreateFileMapping(file_handle, nullptr, PAGE_READONLY, file_size.HighPart, file_size.LowPart, nullptr);
     if ((map_handle == INVALID_HANDLE_VALUE) || (map_handle == nullptr))
     {
@@ -122,17 +131,8 @@ std::shared_ptr<ReadableFile> ReadableFile::get(const Str& file_path)
       return {};
     }
 
-    auto* map_start = ::MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, file_size.QuadPart);
-    if (nullptr == map_start)
-    {
-      ::CloseHandle(map_handle);
-      ::CloseHandle(file_handle);
-      return {};
-    }
-
     readable_file_ptr->path_        = std::move(file_path_fixed_separators);
     readable_file_ptr->size_        = file_size.QuadPart;
-    readable_file_ptr->data_        = static_cast<uint8_t*>(map_start);
     readable_file_ptr->handle_      = file_handle;
     readable_file_ptr->map_handle_  = map_handle;
   }
@@ -141,8 +141,66 @@ std::shared_ptr<ReadableFile> ReadableFile::get(const Str& file_path)
   files[readable_file_ptr->path_] = readable_file_ptr;
   return readable_file_ptr;
 }
+
+bool ReadableFile::isUpToDate() const
+{
+  WIN32_FILE_ATTRIBUTE_DATA file_attributes;
+#if !defined(__GNUG__)
+  if (0 == ::GetFileAttributesExW(path_.c_str(), GetFileExInfoStandard, &file_attributes))
+#else
+  if (0 == ::GetFileAttributesExA(path_.c_str(), GetFileExInfoStandard, &file_attributes))
+#endif
+  {
+    return false;
+  }
+
+  LARGE_INTEGER file_size;
+  file_size.LowPart  = file_attributes.nFileSizeLow;
+  file_size.HighPart = file_attributes.nFileSizeHigh;
+
+  return (static_cast<std::size_t>(file_size.QuadPart) == size_)
+      && (0 == ::CompareFileTime(&file_attributes.ftCreationTime,   &creation_time_))
+      && (0 == ::CompareFileTime(&file_attributes.ftLastWriteTime,  &last_write_time_));
+}
+
+std::shared_ptr<FileWindow> ReadableFile::mapWindow(std::size_t offset, std::size_t size) const
+{
+  if ((offset >= size_) || (size == 0) || (map_handle_ == INVALID_HANDLE_VALUE))
+  {
+    return {};
+  }
+
+  size = (std::min)(size, size_ - offset);
+
+  // The offset of a view must be a multiple of the allocation granularity
+  static const std::size_t allocation_granularity = []()
+                                                    {
+                                                      SYSTEM_INFO system_info;
+                                                      ::GetSystemInfo(&system_info);
+                                                      return static_cast<std::size_t>(system_info.dwAllocationGranularity);
+                                                    }();
+  const std::size_t view_offset = offset - (offset % allocation_granularity);
+  const std::size_t view_size   = size + (offset - view_offset);
+
+  ULARGE_INTEGER view_offset_li;
+  view_offset_li.QuadPart = view_offset;
+
+  auto* view_start = ::MapViewOfFile(map_handle_, FILE_MAP_READ, view_offset_li.HighPart, view_offset_li.LowPart, view_size);
+  if (nullptr == view_start)
+  {
+    return {};
+  }
+
+  std::shared_ptr<FileWindow> window(new FileWindow{});
+  window->view_start_ = view_start;
+  window->offset_     = offset;
+  window->size_       = size;
+  window->data_       = static_cast<uint8_t*>(view_start) + (offset - view_offset);
+  return window;
+}
   
-WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mode)
+WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mode, std::uint64_t offset)
+  : filename_(filename)
 {
   // std::ios::binary is ignored in mode because, on Windows, even ASCII files have to be stored as
   // binary files as they come in with the right line endings.
@@ -158,6 +216,10 @@ WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mod
   {
     dwCreationDisposition = OPEN_EXISTING;   // Append => Open existing file
   }
+  else if (offset > 0)
+  {
+    dwCreationDisposition = OPEN_ALWAYS;     // Restart => Keep the existing content
+  }
   else
   {
     dwCreationDisposition = CREATE_ALWAYS;   // Not Append => Create new file
@@ -178,6 +240,15 @@ WriteableFile::WriteableFile(const std::string& filename, std::ios::openmode mod
       close();
     }
   }
+  else if (INVALID_HANDLE_VALUE != handle_ && offset > 0)
+  {
+    LARGE_INTEGER distance;
+    distance.QuadPart = static_cast<LONGLONG>(offset);
+    if (!::SetFilePointerEx(handle_, distance, nullptr, FILE_BEGIN))
+    {
+      close();
+    }
+  }
 }
 
 WriteableFile::~WriteableFile()
@@ -191,7 +262,78 @@ void WriteableFile::close()
   {
     ::CloseHandle(handle_);
     handle_ = INVALID_HANDLE_VALUE;
+
+    // A temporary file that has not been committed is not needed anymore
+    if (!commit_target_.empty())
+    {
+#if !defined(__GNUG__)
+      ::DeleteFileW(StrConvert::Utf8ToWide(filename_).c_str());
+#else
+      ::DeleteFileA(filename_.c_str());
+#endif
+      commit_target_.clear();
+    }
+  }
+}
+
+void WriteableFile::setCommitTarget(const std::string& target_filename)
+{
+  commit_target_ = target_filename;
+}
+
+bool WriteableFile::commit(bool durable)
+{
+  // The data must be on the disk before the file is put in place, or a
+  // crash may leave the target with the new name but without the new data
+  if (durable && !sync())
+  {
+    close();
+    return false;
   }
+
+  return putInPlace(durable);
+}
+
+std::vector<bool> WriteableFile::commit(const std::vector<std::shared_ptr<WriteableFile>>& files)
+{
+  // Windows cannot flush several files or directories at once
+  std::vector<bool> committed(files.size(), false);
+  for (std::size_t i = 0; i < files.size(); i++)
+    committed[i] = files[i]->commit(true);
+  return committed;
+}
+
+bool WriteableFile::putInPlace(bool write_through)
+{
+  if (commit_target_.empty())
+  {
+    const bool was_open = good();
+    close();
+    return was_open;
+  }
+
+  const bool was_open = good();
+
+  // The file has to be closed before it can be moved. It must not be
+  // removed by close(), though.
+  const std::string target_filename = commit_target_;
+  commit_target_.clear();
+  close();
+
+  const DWORD move_flags = (MOVEFILE_REPLACE_EXISTING | (write_through ? MOVEFILE_WRITE_THROUGH : 0));
+
+#if !defined(__GNUG__)
+  const auto wfilename        = StrConvert::Utf8ToWide(filename_);
+  const auto wtarget_filename = StrConvert::Utf8ToWide(target_filename);
+  if (was_open && ::MoveFileExW(wfilename.c_str(), wtarget_filename.c_str(), move_flags))
+    return true;
+  ::DeleteFileW(wfilename.c_str());
+#else
+  if (was_open && ::MoveFileExA(filename_.c_str(), target_filename.c_str(), move_flags))
+    return true;
+  ::DeleteFileA(filename_.c_str());
+#endif
+  return false;
 }
   
 void WriteableFile::write(const char* data, std::size_t sz)
@@ -200,5 +342,47 @@ void WriteableFile::write(const char* data, std::size_t sz)
   (void)::WriteFile(handle_, data, static_cast<DWORD>(sz), &bytes_written, nullptr);
 }
 
+bool WriteableFile::preallocate(std::uint64_t size)
+{
+  if ((INVALID_HANDLE_VALUE == handle_) || (size == 0))
+    return true;
+
+  // The space is needed from the current write position on, which is not
+  // the end of the file when resuming an upload. The allocation size may
+  // exceed the end of the file. Windows releases the space beyond the end of
+  // the file when the handle is closed.
+  LARGE_INTEGER offset{};
+  if (!::SetFilePointerEx(handle_, LARGE_INTEGER{}, &offset, FILE_CURRENT))
+    return true;
+
+  FILE_ALLOCATION_INFO allocation_info{};
+  allocation_info.AllocationSize.QuadPart = offset.QuadPart + static_cast<LONGLONG>(size);
+  if (!::SetFileInformationByHandle(handle_, FileAllocationInfo, &allocation_info, sizeof(allocation_info)))
+  {
+    const DWORD error = ::GetLastError();
+    return (error != ERROR_DISK_FULL) && (error != ERROR_HANDLE_DISK_FULL);
+  }
+  return true;
+}
+
+bool WriteableFile::sync()
+{
+  return (INVALID_HANDLE_VALUE != handle_) && (0 != ::FlushFileBuffers(handle_));
+}
+
+std::vector<bool> WriteableFile::sync(const std::vector<std::shared_ptr<WriteableFile>>& files)
+{
+  std::vector<bool> durable(files.size(), false);
+  for (std::size_t i = 0; i < files.size(); i++)
+    durable[i] = files[i]->sync();
+  return durable;
+}
+
+void WriteableFile::write(const std::vector<std::shared_ptr<std::vector<char>>>& buffers)
+{
+  for (const auto& buffer : buffers)
+    write(buffer->data(), buffer->size());
+}
+
 }
 
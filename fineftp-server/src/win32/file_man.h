@@ -5,15 +5,64 @@
 
 #include <windows.h>
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <ios>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace fineftp
 {
 
-/// A memory mapped read-only file.
+/// A read-only memory mapped segment of a ReadableFile.
+///
+/// The segment stays mapped for as long as the FileWindow exists. It remains
+/// valid even if the ReadableFile it has been created from is destroyed.
+class FileWindow
+{
+public:
+  FileWindow(const FileWindow&)            = delete;
+  FileWindow& operator=(const FileWindow&) = delete;
+  FileWindow(FileWindow&&)                 = delete;
+  FileWindow& operator=(FileWindow&&)      = delete;
+  ~FileWindow();
+
+  /// Returns the offset of the window in the file.
+  ///
+  /// @return The offset of the first byte of the window.
+  std::size_t offset() const;
+
+  /// Returns the size of the window.
+  ///
+  /// @return The size of the window.
+  std::size_t size() const;
+
+  /// Returns a pointer to the beginning of the window contents.
+  ///
+  /// @return A pointer to the file contents at offset().
+  const std::uint8_t* data() const;
+
+  /// Returns how much of the window can be read without waiting for the disk.
+  ///
+  /// Windows does not tell, so the whole window is considered resident.
+  ///
+  /// @return The number of bytes from the beginning of the window that are
+  ///         in the page cache.
+  std::size_t residentSize() const;
+
+private:
+  friend class ReadableFile;
+  FileWindow() = default;
+
+  void*         view_start_ = {};  ///< Start of the view, aligned to the allocation granularity
+  std::size_t   offset_     = {};
+  std::size_t   size_       = {};
+  std::uint8_t* data_       = {};
+};
+
+/// A read-only file that is mapped into memory segment by segment.
 ///
 /// @note The implementation is NOT thread safe!
 class ReadableFile
@@ -33,6 +82,9 @@ public:
 
   /// Retrieves the file at the specified path.
   ///
+  /// If the file is already open, the open file is shared, unless the path
+  /// refers to a different or modified file by now (see isUpToDate()).
+  ///
   /// @param file_path      The path of the file.
   ///
   /// @param The requested file or nullptr if the file could not be retrieved.
@@ -43,10 +95,68 @@ public:
   /// @return The size of the file.
   std::size_t size() const;
 
-  /// Returns a pointer to the beginning of the file contents.
+  /// Checks whether the path of the file still refers to the same, unmodified
+  /// file.
   ///
-  /// @return A pointer to the beginning of the file contents.
-  const std::uint8_t* data() const;
+  /// The attributes of the path are compared to the size, creation time and
+  /// last write time the file had when it was opened. As the file is opened
+  /// without write or delete sharing, this only fails if the file has been
+  /// replaced before it was opened by us or after it was closed.
+  ///
+  /// @return True, if the file at path() is still the file that is open.
+  bool isUpToDate() const;
+
+  /// Maps a segment of the file into memory.
+  ///
+  /// If the segment exceeds the end of the file, the returned window is
+  /// shortened accordingly.
+  ///
+  /// @param offset   The offset of the first byte to map.
+  /// @param size     The maximum number of bytes to map.
+  ///
+  /// @return The mapped window or nullptr if the segment could not be mapped.
+  std::shared_ptr<FileWindow> mapWindow(std::size_t offset, std::size_t size) const;
+
+  /// Advises the operating system to read the given segment of the file ahead.
+  ///
+  /// This is a no-op on Windows, where the memory manager already reads
+  /// ahead views that are accessed sequentially.
+  ///
+  /// @param offset   The offset of the first byte that will be needed soon.
+  /// @param size     The number of bytes that will be needed soon.
+  void prefetch(std::size_t offset, std::size_t size) const;
+
+  /// Returns how much of the given segment can be read without waiting for
+  /// the disk.
+  ///
+  /// Windows does not tell, so the whole segment is considered resident.
+  ///
+  /// @param offset   The offset of the first byte of the segment.
+  /// @param size     The size of the segment.
+  ///
+  /// @return The number of bytes from offset on that are in the page cache.
+  std::size_t residentSize(std::size_t offset, std::size_t size) const;
+
+  /// Reads the given segment of the file into the page cache.
+  ///
+  /// This blocks until the data has been read and must therefore not be
+  /// called on an io thread (see FilePrefetcher). This is a no-op on Windows,
+  /// where residentSize() never asks for loading anything.
+  ///
+  /// @param offset   The offset of the first byte to read.
+  /// @param size     The number of bytes to read.
+  void load(std::size_t offset, std::size_t size) const;
+
+  /// Advises the kernel to drop the given segment of the file from the page
+  /// cache, as it will not be needed again soon.
+  ///
+  /// Pages that are still in use (e.g. mapped) are kept. A page that is only
+  /// partially covered by the segment is dropped as well. This is a no-op on
+  /// Windows.
+  ///
+  /// @param offset   The offset of the first byte that is not needed anymore.
+  /// @param size     The number of bytes that are not needed anymore.
+  void dropFromCache(std::size_t offset, std::size_t size) const;
 
   /// Returns the path of the file.
   ///
@@ -58,9 +168,10 @@ private:
 
   Str           path_       = {};
   std::size_t   size_       = {};
-  std::uint8_t* data_       = {};
   HANDLE        handle_     = INVALID_HANDLE_VALUE;
   HANDLE        map_handle_ = INVALID_HANDLE_VALUE;
+  FILETIME      creation_time_   = {};
+  FILETIME      last_write_time_ = {};
 };
 
 
@@ -72,7 +183,9 @@ public:
   ///
   /// @param filename  The (UTF-8 encoded) name of the file.
   /// @param mode      The open mode to use for the file (std::ios::out is implied).
-  WriteableFile(const std::string& filename, std::ios::openmode mode);
+  /// @param offset    The offset to start writing at. If not 0, an existing
+  ///                  file is not truncated. Ignored in append mode.
+  WriteableFile(const std::string& filename, std::ios::openmode mode, std::uint64_t offset = 0);
 
   // Copy disable
   WriteableFile(const WriteableFile&)            = delete;
@@ -85,11 +198,76 @@ public:
   ~WriteableFile();
 
   void write(const char* data, std::size_t sz);
+
+  /// Writes the given buffers one after another. On Linux, all buffers are
+  /// passed to the kernel at once.
+  ///
+  /// @param buffers  The data to write.
+  void write(const std::vector<std::shared_ptr<std::vector<char>>>& buffers);
+
+  /// Allocates disk space for the next size bytes of the file, so the data
+  /// does not have to be allocated piece by piece while it is written. The
+  /// size of the file does not change until the data is written. Failures
+  /// other than a lack of space are ignored, as the preallocation is just an
+  /// optimization.
+  ///
+  /// @param size   The number of bytes that are going to be written.
+  ///
+  /// @return False, if there is not enough space on the disk.
+  bool preallocate(std::uint64_t size);
+
+  /// Makes the data written so far durable.
+  ///
+  /// @return True, if the data has been flushed to the disk.
+  bool sync();
+
+  /// Makes the data written to all given files durable.
+  ///
+  /// @param files  The files to sync.
+  ///
+  /// @return For each file, whether its data has been flushed to the disk.
+  static std::vector<bool> sync(const std::vector<std::shared_ptr<WriteableFile>>& files);
+
+  /// Turns the file into a temporary file that replaces the given target
+  /// file when it is committed. If the file is closed (or destroyed) without
+  /// being committed, it is removed, so an aborted upload leaves no debris.
+  ///
+  /// @param target_filename  The (UTF-8 encoded) name of the file to replace.
+  void setCommitTarget(const std::string& target_filename);
+
+  /// Closes the file. A temporary file (see setCommitTarget()) atomically
+  /// replaces its target file.
+  ///
+  /// @param durable  Whether the file has to survive a crash. The data is
+  ///                 then synced before the move and the move is written
+  ///                 through. This blocks until the disk has flushed the data.
+  ///
+  /// @return True, if all data has been written and the file is in place.
+  bool commit(bool durable = false);
+
+  /// Commits all given files durably (see commit()).
+  ///
+  /// @param files  The files to commit.
+  ///
+  /// @return For each file, whether it is durably in place.
+  static std::vector<bool> commit(const std::vector<std::shared_ptr<WriteableFile>>& files);
+
   void close();
   bool good() const;
 
+  /// The (UTF-8 encoded) name of the file that is written. This is the
+  /// temporary file, if setCommitTarget() has been called.
+  const std::string& filename() const;
+
 private:
-  HANDLE handle_ = INVALID_HANDLE_VALUE;
+  /// Closes the file and moves a temporary file to its commit target.
+  ///
+  /// @param write_through  Whether to wait until the move is on the disk.
+  bool putInPlace(bool write_through);
+
+  HANDLE      handle_ = INVALID_HANDLE_VALUE;
+  std::string filename_;
+  std::string commit_target_;   ///< The file that is replaced by commit(), empty if this is not a temporary file
 };
 
 
@@ -98,11 +276,40 @@ inline std::size_t ReadableFile::size() const
   return size_;
 }
 
-inline const std::uint8_t* ReadableFile::data() const
+inline std::size_t FileWindow::offset() const
+{
+  return offset_;
+}
+
+inline std::size_t FileWindow::size() const
+{
+  return size_;
+}
+
+inline const std::uint8_t* FileWindow::data() const
 {
   return data_;
 }
 
+inline std::size_t FileWindow::residentSize() const
+{
+  return size_;
+}
+
+inline void ReadableFile::prefetch(std::size_t /*offset*/, std::size_t /*size*/) const
+{}
+
+inline std::size_t ReadableFile::residentSize(std::size_t offset, std::size_t size) const
+{
+  return ((offset < size_) ? (std::min)(size, size_ - offset) : 0);
+}
+
+inline void ReadableFile::load(std::size_t /*offset*/, std::size_t /*size*/) const
+{}
+
+inline void ReadableFile::dropFromCache(std::size_t /*offset*/, std::size_t /*size*/) const
+{}
+
 inline const ReadableFile::Str& ReadableFile::path() const
 {
   return path_;
@@ -113,6 +320,11 @@ inline bool WriteableFile::good() const
   return INVALID_HANDLE_VALUE != handle_;
 }
 
+inline const std::string& WriteableFile::filename() const
+{
+  return filename_;
+}
+
 }
 
 #endif  // FINEFTP_SERVER_SRC_WIN32_FILE_MAN_H_